@@ -1,5 +1,21 @@
+#define _POSIX_C_SOURCE 200809L
 #include "lib/mpc.h"
 #include <math.h>
+#include <float.h>
+#include <limits.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define LSTR_SIMD
+#include <immintrin.h>
+#endif
 
 // windows stuff
 #ifdef _WIN32
@@ -59,6 +75,24 @@ void add_history(char* unused) {}
             "Got %s, Expected %s or %s.", \
             func, index, ltype_name(args->cell[index]->type), ltype_name(type1), ltype_name(type2));
 
+#define LASSERT_SEQ(func, args, index) \
+    LASSERT(args, (args->cell[index]->type == LVAL_QEXPR || \
+                   args->cell[index]->type == LVAL_RANGE || \
+                   args->cell[index]->type == LVAL_LAZY), \
+            "Function '%s' passed incorrect type for argument %i. " \
+            "Got %s, Expected %s, %s or %s.", \
+            func, index, ltype_name(args->cell[index]->type), ltype_name(LVAL_QEXPR), \
+            ltype_name(LVAL_RANGE), ltype_name(LVAL_LAZY))
+
+#define LASSERT_KEY(func, args, index) \
+    LASSERT(args, (args->cell[index]->type == LVAL_INT || \
+                   args->cell[index]->type == LVAL_FLOAT || \
+                   args->cell[index]->type == LVAL_STR), \
+            "Function '%s' passed incorrect key type for argument %i. " \
+            "Got %s, Expected %s, %s or %s.", \
+            func, index, ltype_name(args->cell[index]->type), ltype_name(LVAL_INT), \
+            ltype_name(LVAL_FLOAT), ltype_name(LVAL_STR))
+
 
 // FORWARD DECLARATIONS
 // TODO: make an ok value to return instead of ()
@@ -69,6 +103,12 @@ typedef struct lenv lenv;
 void lenv_del(lenv* e);
 lenv* lenv_copy(lenv* e);
 lval* lval_eval(lenv* e, lval* v);
+lval* lval_copy(lval* v);
+int lval_eq(lval* a, lval* b);
+int lval_eq_num(lval* a, lval* b);
+lval* lval_seq_slice(lval* l, int from, int to);
+lval* lval_seq_take(lenv* e, lval* seq, int n);
+lval* lval_seq_count(lenv* e, lval* seq);
 
 // FORWARD PARSER DECLARATIONS
 mpc_parser_t* Float;
@@ -83,33 +123,146 @@ mpc_parser_t* Slither;
 
 // possible lval types enum
 // TODO: Make LVAL_BOOL type
-enum { LVAL_INT, LVAL_FLOAT, LVAL_ERR, LVAL_SYM, LVAL_SEXPR, LVAL_QEXPR, LVAL_FUN, LVAL_STR };
+enum { LVAL_INT, LVAL_FLOAT, LVAL_ERR, LVAL_SYM, LVAL_SEXPR, LVAL_QEXPR, LVAL_FUN, LVAL_STR,
+       LVAL_RANGE, LVAL_LAZY, LVAL_MAP, LVAL_SORTED_MAP, LVAL_SBUILDER };
+
+// lazy sequence stage types
+enum { LAZY_MAP, LAZY_FILTER, LAZY_TAKE_WHILE, LAZY_TAKE };
 
 // possible error types
 enum { LERR_DIV_ZERO, LERR_BAD_OP, LERR_BAD_NUM };
 
 typedef lval*(*lbuiltin) (lenv*, lval*);
 
+// growable byte buffer, used for serializing and by string builders
+typedef struct {
+    char* data;
+    size_t len;
+    size_t cap;
+} lbuf;
+
+// shared string builder buffer
+typedef struct {
+    int refs;
+    pthread_rwlock_t lock;
+    lbuf buf;
+} lsbuilder;
+
+// one stage of a lazy sequence pipeline
+typedef struct {
+    int kind;
+    lval* fn;
+    int n;
+} lstage;
+
+// hash map slot, key is NULL when empty
+typedef struct {
+    unsigned int hash;
+    lval* key;
+    lval* val;
+} lmap_entry;
+
+// shared hash map table
+typedef struct {
+    int refs;
+    pthread_rwlock_t lock;
+    int count;
+    int used;
+    int cap;
+    lmap_entry* entries;
+} lmap;
+
+// strings up to this many bytes are stored inside the lval itself
+#define LSTR_INLINE 15
+
+// shared buffer behind longer strings. copies and slices of a string point
+// into the same buffer, which always ends in a NUL at data[len]
+typedef struct {
+    int refs;
+    int len;
+    char* data;
+} lstrbuf;
+
+// sorted map B-tree node, holding between t-1 and 2t-1 keys
+#define BT_MIN_DEGREE 16
+#define BT_MAX_KEYS (2 * BT_MIN_DEGREE - 1)
+
+typedef struct lbnode {
+    int count;
+    int leaf;
+    lval* keys[BT_MAX_KEYS];
+    lval* vals[BT_MAX_KEYS];
+    struct lbnode* kids[BT_MAX_KEYS + 1];
+} lbnode;
+
+// shared sorted map tree
+typedef struct {
+    int refs;
+    pthread_rwlock_t lock;
+    int count;
+    lbnode* root;
+} lbtree;
+
 // declare new lval struct (lisp value)
+// a value only ever uses the fields of its own type, so they share space
 struct lval {
     int type;
 
-    // Basic
-    int integer;
-    float ffloat;
-    char* err;
-    char* sym;
-    char* str;
-
-    // Function
-    lbuiltin builtin;
-    lenv* env;
-    lval* formals;
-    lval* body;
-
-    // Expression
-    int count;
-    lval** cell;
+    union {
+        // Basic
+        int integer;
+        float ffloat;
+        char* err;
+        char* sym;
+
+        // Function
+        struct {
+            lbuiltin builtin;
+            lenv* env;
+            lval* formals;
+            lval* body;
+        };
+
+        // Expression
+        struct {
+            int count;
+            lval** cell;
+        };
+
+        // String, str points into sso when the string fits inline and into
+        // sbase otherwise, where it may be a slice that is not NUL terminated
+        struct {
+            char* str;
+            lstrbuf* sbase;
+            int slen;
+            unsigned int shash;
+            char sso[LSTR_INLINE + 1];
+        };
+
+        // Range (start inclusive, stop exclusive)
+        struct {
+            int start;
+            int stop;
+            int step;
+        };
+
+        // Lazy sequence
+        struct {
+            lval* source;
+            int lines;
+            int stage_count;
+            lstage* stages;
+        };
+
+        // Hash map
+        lmap* map;
+
+        // Sorted map
+        lbtree* tree;
+
+        // String builder
+        lsbuilder* sb;
+    };
 };
 
 // lenv struct
@@ -121,6 +274,67 @@ struct lenv {
     lval** vals;
 };
 
+// while pmap workers are running the global environment is shared between
+// threads, so reads and writes to it take lenv_lock. maps and string
+// builders are shared between copies of them, so they could be reached from
+// several workers at once, and take their own lock while workers run
+static pthread_rwlock_t lenv_lock = PTHREAD_RWLOCK_INITIALIZER;
+static int lenv_shared = 0;
+
+void ltable_read(pthread_rwlock_t* lock) {
+    if (lenv_shared) { pthread_rwlock_rdlock(lock); }
+}
+
+void ltable_write(pthread_rwlock_t* lock) {
+    if (lenv_shared) { pthread_rwlock_wrlock(lock); }
+}
+
+void ltable_done(pthread_rwlock_t* lock) {
+    if (lenv_shared) { pthread_rwlock_unlock(lock); }
+}
+
+// marks a deleted hash map slot so probing carries on past it
+static lval lmap_tombstone;
+
+int lmap_live(lmap_entry* en) {
+    return en->key && en->key != &lmap_tombstone;
+}
+
+void lmap_release(lmap* m);
+void lbtree_release(lbtree* t);
+int lbnode_scan(lbnode* n, lval* lo, lval* hi, lval* out);
+
+void lbuf_write(lbuf* b, const void* p, size_t n) {
+    if (n == 0) { return; }
+    if (b->len + n > b->cap) {
+        while (b->len + n > b->cap) { b->cap = b->cap ? b->cap * 2 : 4096; }
+        b->data = realloc(b->data, b->cap);
+    }
+    memcpy(b->data + b->len, p, n);
+    b->len += n;
+}
+
+lstrbuf* lstrbuf_new(char* data, int len) {
+    lstrbuf* b = malloc(sizeof(lstrbuf));
+    b->refs = 1;
+    b->len = len;
+    b->data = data;
+    return b;
+}
+
+void lstrbuf_release(lstrbuf* b) {
+    if (__sync_sub_and_fetch(&b->refs, 1) != 0) { return; }
+    free(b->data);
+    free(b);
+}
+
+void lsbuilder_release(lsbuilder* sb) {
+    if (__sync_sub_and_fetch(&sb->refs, 1) != 0) { return; }
+    pthread_rwlock_destroy(&sb->lock);
+    free(sb->buf.data);
+    free(sb);
+}
+
 char* ltype_name(int t) {
     switch(t) {
         case LVAL_FUN: return "Function";
@@ -131,6 +345,11 @@ char* ltype_name(int t) {
         case LVAL_SEXPR: return "S-Expression";
         case LVAL_QEXPR: return "Q-Expression";
         case LVAL_STR: return "String";
+        case LVAL_RANGE: return "Range";
+        case LVAL_LAZY: return "Lazy Sequence";
+        case LVAL_MAP: return "Map";
+        case LVAL_SORTED_MAP: return "Sorted Map";
+        case LVAL_SBUILDER: return "String Builder";
         default: return "Unknown";
     }
 }
@@ -149,7 +368,8 @@ void lval_del(lval* v) {
     switch (v->type) {
         // do nothing for a number type or function type
         case LVAL_FLOAT:
-        case LVAL_INT: break;
+        case LVAL_INT:
+        case LVAL_RANGE: break;
         case LVAL_FUN:
             if (!v->builtin) {
                 lenv_del(v->env);
@@ -170,8 +390,18 @@ void lval_del(lval* v) {
             free(v->cell);
         break;
         case LVAL_STR:
-            free(v->str);
+            if (v->str != v->sso) { lstrbuf_release(v->sbase); }
+        break;
+        case LVAL_LAZY:
+            lval_del(v->source);
+            for (int i = 0; i < v->stage_count; i++) {
+                if (v->stages[i].fn) { lval_del(v->stages[i].fn); }
+            }
+            free(v->stages);
         break;
+        case LVAL_MAP: lmap_release(v->map); break;
+        case LVAL_SORTED_MAP: lbtree_release(v->tree); break;
+        case LVAL_SBUILDER: lsbuilder_release(v->sb); break;
     }
     // free entire lval struct itself
     free(v);
@@ -224,14 +454,83 @@ lval* lval_fun(lbuiltin func) {
     return v;
 }
 
+// construct a string lval from n bytes of s, short strings are kept inline
+lval* lval_str_n(const char* s, int n) {
+    lval* v = malloc(sizeof(lval));
+    v->type = LVAL_STR;
+    if (n <= LSTR_INLINE) {
+        v->str = v->sso;
+    } else {
+        v->sbase = lstrbuf_new(malloc(n + 1), n);
+        v->str = v->sbase->data;
+    }
+    if (n) { memcpy(v->str, s, n); }
+    v->str[n] = '\0';
+    v->slen = n;
+    v->shash = 0;
+    return v;
+}
+
 lval* lval_str(char* s) {
+    return lval_str_n(s, (int) strlen(s));
+}
+
+// construct a pointer to a new empty string builder lval
+lval* lval_sbuilder(void) {
+    lval* v = malloc(sizeof(lval));
+    v->type = LVAL_SBUILDER;
+    v->sb = malloc(sizeof(lsbuilder));
+    v->sb->refs = 1;
+    pthread_rwlock_init(&v->sb->lock, NULL);
+    v->sb->buf.data = NULL;
+    v->sb->buf.len = 0;
+    v->sb->buf.cap = 0;
+    return v;
+}
+
+// string lval that takes ownership of an already malloc'd buffer of n bytes
+lval* lval_str_own(char* s, int n) {
+    if (n <= LSTR_INLINE) {
+        lval* v = lval_str_n(s, n);
+        free(s);
+        return v;
+    }
+    lval* v = malloc(sizeof(lval));
+    v->type = LVAL_STR;
+    v->sbase = lstrbuf_new(s, n);
+    v->str = s;
+    v->slen = n;
+    v->shash = 0;
+    return v;
+}
+
+// the n bytes of string s from offset from. long slices share the buffer of
+// s rather than copying, short ones are copied inline
+lval* lval_str_slice(lval* s, int from, int n) {
+    if (n <= LSTR_INLINE) { return lval_str_n(s->str + from, n); }
     lval* v = malloc(sizeof(lval));
     v->type = LVAL_STR;
-    v->str = malloc(strlen(s) + 1);
-    strcpy(v->str, s);
+    v->sbase = s->sbase;
+    __sync_fetch_and_add(&v->sbase->refs, 1);
+    v->str = s->str + from;
+    v->slen = n;
+    v->shash = 0;
     return v;
 }
 
+// NUL terminated contents of a string for passing to C functions. slices
+// that stop short of the end of their buffer are copied out first
+char* lval_cstr(lval* v) {
+    if (v->str[v->slen] == '\0') { return v->str; }
+    char* s = malloc(v->slen + 1);
+    memcpy(s, v->str, v->slen);
+    s[v->slen] = '\0';
+    lstrbuf_release(v->sbase);
+    v->sbase = lstrbuf_new(s, v->slen);
+    v->str = s;
+    return s;
+}
+
 // construct a pointer to a new long type lval
 lval* lval_int(int x) {
     lval* v = malloc(sizeof(lval));
@@ -280,6 +579,16 @@ lval* lval_sym(char* s) {
     return v;
 }
 
+// symbol from the first n bytes of s
+lval* lval_sym_n(const char* s, int n) {
+    lval* v = malloc(sizeof(lval));
+    v->type = LVAL_SYM;
+    v->sym = malloc(n + 1);
+    memcpy(v->sym, s, n);
+    v->sym[n] = '\0';
+    return v;
+}
+
 // construct a new pointer to an empty sexpr lval
 lval* lval_sexpr(void) {
     lval* v = malloc(sizeof(lval));
@@ -298,42 +607,465 @@ lval* lval_qexpr(void) {
     return v;
 }
 
-// lval read num
-lval* lval_read_int(mpc_ast_t* t) {
-    errno = 0;
-    int x = strtol(t->contents, NULL, 10);
-    return errno != ERANGE ?
-        lval_int(x) : lval_err("invalid long");
+// construct a pointer to a new lazy range lval
+lval* lval_range(int start, int stop, int step) {
+    lval* v = malloc(sizeof(lval));
+    v->type = LVAL_RANGE;
+    v->start = start;
+    v->stop = stop;
+    v->step = step;
+    return v;
+}
+
+// number of values a range from start to stop by step produces, which can
+// be more than fits in an int
+long long lrange_count(int start, int stop, int step) {
+    long long span = (long long) stop - start;
+    long long n = step;
+    if (n < 0) { span = -span; n = -n; }
+    return span > 0 ? (span + n - 1) / n : 0;
+}
+
+// number of values a range produces. range refuses to make one longer than
+// INT_MAX, so the clamp only guards against ranges built some other way
+int lval_range_len(lval* r) {
+    long long n = lrange_count(r->start, r->stop, r->step);
+    return n > INT_MAX ? INT_MAX : (int) n;
+}
+
+// value at position i of a range
+int lval_range_nth(lval* r, int i) {
+    return (int) (r->start + (long long) i * r->step);
+}
+
+// number of items in a sequence (Q-Expression or range)
+int lval_seq_len(lval* v) {
+    return v->type == LVAL_RANGE ? lval_range_len(v) : v->count;
+}
+
+// expand a range into a Q-Expression of its values, deleting the range
+lval* lval_range_realize(lval* r) {
+    int n = lval_range_len(r);
+    lval* x = lval_qexpr();
+    x->count = n;
+    x->cell = malloc(sizeof(lval*) * n);
+    for (int i = 0; i < n; i++) {
+        x->cell[i] = lval_int(lval_range_nth(r, i));
+    }
+    lval_del(r);
+    return x;
+}
+
+// new lval holding item i of a sequence
+lval* lval_seq_nth(lval* v, int i) {
+    if (v->type == LVAL_RANGE) { return lval_int(lval_range_nth(v, i)); }
+    return lval_copy(v->cell[i]);
+}
+
+// NUMBER FORMATTING AND PARSING
+// floats are printed with the shortest digit string that reads back to the
+// same float (the Ryu algorithm, specialised for 32 bit floats) and number
+// literals are parsed by hand instead of going back through strtol/strtof
+
+#define FLOAT_MANTISSA_BITS 23
+#define FLOAT_BIAS 127
+#define FLOAT_POW5_INV_BITCOUNT 59
+#define FLOAT_POW5_BITCOUNT 61
+
+// floor(2^k / 5^i) + 1 and 5^i scaled to 61 bits
+static const uint64_t FLOAT_POW5_INV_SPLIT[31] = {
+    576460752303423489ull, 461168601842738791ull, 368934881474191033ull,
+    295147905179352826ull, 472236648286964522ull, 377789318629571618ull,
+    302231454903657294ull, 483570327845851670ull, 386856262276681336ull,
+    309485009821345069ull, 495176015714152110ull, 396140812571321688ull,
+    316912650057057351ull, 507060240091291761ull, 405648192073033409ull,
+    324518553658426727ull, 519229685853482763ull, 415383748682786211ull,
+    332306998946228969ull, 531691198313966350ull, 425352958651173080ull,
+    340282366920938464ull, 544451787073501542ull, 435561429658801234ull,
+    348449143727040987ull, 557518629963265579ull, 446014903970612463ull,
+    356811923176489971ull, 570899077082383953ull, 456719261665907162ull,
+    365375409332725730ull,
+};
+
+static const uint64_t FLOAT_POW5_SPLIT[47] = {
+    1152921504606846976ull, 1441151880758558720ull, 1801439850948198400ull,
+    2251799813685248000ull, 1407374883553280000ull, 1759218604441600000ull,
+    2199023255552000000ull, 1374389534720000000ull, 1717986918400000000ull,
+    2147483648000000000ull, 1342177280000000000ull, 1677721600000000000ull,
+    2097152000000000000ull, 1310720000000000000ull, 1638400000000000000ull,
+    2048000000000000000ull, 1280000000000000000ull, 1600000000000000000ull,
+    2000000000000000000ull, 1250000000000000000ull, 1562500000000000000ull,
+    1953125000000000000ull, 1220703125000000000ull, 1525878906250000000ull,
+    1907348632812500000ull, 1192092895507812500ull, 1490116119384765625ull,
+    1862645149230957031ull, 1164153218269348144ull, 1455191522836685180ull,
+    1818989403545856475ull, 2273736754432320594ull, 1421085471520200371ull,
+    1776356839400250464ull, 2220446049250313080ull, 1387778780781445675ull,
+    1734723475976807094ull, 2168404344971008868ull, 1355252715606880542ull,
+    1694065894508600678ull, 2117582368135750847ull, 1323488980084844279ull,
+    1654361225106055349ull, 2067951531382569187ull, 1292469707114105741ull,
+    1615587133892632177ull, 2019483917365790221ull,
+};
+
+static int pow5bits(int e) { return (int) (((uint32_t) e * 1217359) >> 19) + 1; }
+static int log10_pow2(int e) { return (int) (((uint32_t) e * 78913) >> 18); }
+static int log10_pow5(int e) { return (int) (((uint32_t) e * 732923) >> 20); }
+
+static int pow5_factor(uint32_t v) {
+    int count = 0;
+    while (v % 5 == 0) { v /= 5; count++; }
+    return count;
+}
+
+// (m * factor) >> shift without needing 128 bit integers
+static uint32_t mul_shift(uint32_t m, uint64_t factor, int shift) {
+    uint64_t lo = (uint64_t) m * (uint32_t) factor;
+    uint64_t hi = (uint64_t) m * (uint32_t) (factor >> 32);
+    return (uint32_t) (((lo >> 32) + hi) >> (shift - 32));
+}
+
+// write the shortest decimal for a finite non zero float as digits * 10^exp
+static void float_shortest(uint32_t bits, uint32_t* digits, int* exp) {
+    uint32_t ieee_mantissa = bits & ((1u << FLOAT_MANTISSA_BITS) - 1);
+    int ieee_exponent = (int) ((bits >> FLOAT_MANTISSA_BITS) & 0xff);
+
+    int e2;
+    uint32_t m2;
+    if (ieee_exponent == 0) {
+        e2 = 1 - FLOAT_BIAS - FLOAT_MANTISSA_BITS - 2;
+        m2 = ieee_mantissa;
+    } else {
+        e2 = ieee_exponent - FLOAT_BIAS - FLOAT_MANTISSA_BITS - 2;
+        m2 = (1u << FLOAT_MANTISSA_BITS) | ieee_mantissa;
+    }
+    int accept_bounds = (m2 & 1) == 0;
+
+    // the value and the halfway points to its neighbours
+    uint32_t mv = 4 * m2;
+    uint32_t mp = 4 * m2 + 2;
+    uint32_t mm = 4 * m2 - 1 - (ieee_mantissa != 0 || ieee_exponent <= 1);
+
+    uint32_t vr, vp, vm;
+    int e10;
+    int vm_trailing_zeros = 0;
+    int vr_trailing_zeros = 0;
+    uint32_t last_removed = 0;
+    if (e2 >= 0) {
+        int q = log10_pow2(e2);
+        e10 = q;
+        int k = FLOAT_POW5_INV_BITCOUNT + pow5bits(q) - 1;
+        int i = -e2 + q + k;
+        vr = mul_shift(mv, FLOAT_POW5_INV_SPLIT[q], i);
+        vp = mul_shift(mp, FLOAT_POW5_INV_SPLIT[q], i);
+        vm = mul_shift(mm, FLOAT_POW5_INV_SPLIT[q], i);
+        if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+            int l = FLOAT_POW5_INV_BITCOUNT + pow5bits(q - 1) - 1;
+            last_removed = mul_shift(mv, FLOAT_POW5_INV_SPLIT[q - 1], -e2 + q - 1 + l) % 10;
+        }
+        if (q <= 9) {
+            if (mv % 5 == 0) {
+                vr_trailing_zeros = pow5_factor(mv) >= q;
+            } else if (accept_bounds) {
+                vm_trailing_zeros = pow5_factor(mm) >= q;
+            } else {
+                vp -= pow5_factor(mp) >= q;
+            }
+        }
+    } else {
+        int q = log10_pow5(-e2);
+        e10 = q + e2;
+        int i = -e2 - q;
+        int k = pow5bits(i) - FLOAT_POW5_BITCOUNT;
+        int j = q - k;
+        vr = mul_shift(mv, FLOAT_POW5_SPLIT[i], j);
+        vp = mul_shift(mp, FLOAT_POW5_SPLIT[i], j);
+        vm = mul_shift(mm, FLOAT_POW5_SPLIT[i], j);
+        if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+            j = q - 1 - (pow5bits(i + 1) - FLOAT_POW5_BITCOUNT);
+            last_removed = mul_shift(mv, FLOAT_POW5_SPLIT[i + 1], j) % 10;
+        }
+        if (q <= 1) {
+            vr_trailing_zeros = 1;
+            if (accept_bounds) {
+                vm_trailing_zeros = mm == mv - 2;
+            } else {
+                vp--;
+            }
+        } else if (q < 31) {
+            vr_trailing_zeros = (mv & ((1u << (q - 1)) - 1)) == 0;
+        }
+    }
+
+    // drop digits while the neighbours still round to different values
+    int removed = 0;
+    if (vm_trailing_zeros || vr_trailing_zeros) {
+        while (vp / 10 > vm / 10) {
+            vm_trailing_zeros &= vm % 10 == 0;
+            vr_trailing_zeros &= last_removed == 0;
+            last_removed = vr % 10;
+            vr /= 10; vp /= 10; vm /= 10;
+            removed++;
+        }
+        if (vm_trailing_zeros) {
+            while (vm % 10 == 0) {
+                vr_trailing_zeros &= last_removed == 0;
+                last_removed = vr % 10;
+                vr /= 10; vp /= 10; vm /= 10;
+                removed++;
+            }
+        }
+        // round half to even when the digits removed were exactly 5000...
+        if (vr_trailing_zeros && last_removed == 5 && vr % 2 == 0) {
+            last_removed = 4;
+        }
+        *digits = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) || last_removed >= 5);
+    } else {
+        while (vp / 10 > vm / 10) {
+            last_removed = vr % 10;
+            vr /= 10; vp /= 10; vm /= 10;
+            removed++;
+        }
+        *digits = vr + (vr == vm || last_removed >= 5);
+    }
+    *exp = e10 + removed;
+}
+
+// write a float into buf in plain positional notation so that it reads back
+// as the same float, returns the number of characters written (max 64)
+int lval_fmt_float(float f, char* buf) {
+    char* p = buf;
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+
+    if (bits >> 31) { *p++ = '-'; }
+    if (isnan(f)) { strcpy(buf, "nan"); return 3; }
+    if (isinf(f)) { strcpy(p, "inf"); return (int) (p - buf) + 3; }
+    if ((bits & 0x7fffffff) == 0) { memcpy(p, "0.0", 3); return (int) (p - buf) + 3; }
+
+    uint32_t digits;
+    int exp;
+    float_shortest(bits, &digits, &exp);
+
+    // digits come out backwards so render them into a scratch buffer first
+    char tmp[10];
+    int n = 0;
+    while (digits) { tmp[n++] = '0' + digits % 10; digits /= 10; }
+
+    // position of the decimal point relative to the first digit
+    int point = n + exp;
+    if (point <= 0) {
+        *p++ = '0';
+        *p++ = '.';
+        for (int i = 0; i < -point; i++) { *p++ = '0'; }
+        while (n) { *p++ = tmp[--n]; }
+    } else if (exp >= 0) {
+        while (n) { *p++ = tmp[--n]; }
+        for (int i = 0; i < exp; i++) { *p++ = '0'; }
+        *p++ = '.';
+        *p++ = '0';
+    } else {
+        for (int i = 0; i < point; i++) { *p++ = tmp[--n]; }
+        *p++ = '.';
+        while (n) { *p++ = tmp[--n]; }
+    }
+    *p = '\0';
+    return (int) (p - buf);
+}
+
+// write an int into buf, returns the number of characters written (max 11)
+int lval_fmt_int(int x, char* buf) {
+    char tmp[12];
+    int n = 0;
+    // work with the magnitude unsigned so INT_MIN does not overflow
+    unsigned int u = x < 0 ? 0u - (unsigned int) x : (unsigned int) x;
+    do { tmp[n++] = '0' + u % 10; u /= 10; } while (u);
+
+    char* p = buf;
+    if (x < 0) { *p++ = '-'; }
+    while (n) { *p++ = tmp[--n]; }
+    *p = '\0';
+    return (int) (p - buf);
 }
 
-// lval read float
-lval* lval_read_float(mpc_ast_t* t) {
+// exact powers of ten for the fast float path
+static const double POW10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// read an int or float literal in a single pass. the grammar has already
+// checked the text so only the digits and an optional '.' need handling
+lval* lval_read_num(char* s) {
+    char* start = s;
+    int neg = 0;
+    if (*s == '-') { neg = 1; s++; }
+
+    // accumulate up to 19 significant digits exactly
+    uint64_t mantissa = 0;
+    int sig = 0;
+    int frac = 0;
+    int dropped = 0;
+    int is_float = 0;
+    for (; *s; s++) {
+        if (*s == '.') { is_float = 1; continue; }
+        int d = *s - '0';
+        if (sig < 19) {
+            mantissa = mantissa * 10 + d;
+            if (mantissa) { sig++; }
+            if (is_float) { frac++; }
+        } else if (!is_float || d) {
+            dropped++;
+        }
+    }
+
+    if (!is_float) {
+        if (dropped || mantissa > (uint64_t) INT_MAX + neg) {
+            return lval_err("invalid long");
+        }
+        return lval_int(neg ? (int) (0 - mantissa) : (int) mantissa);
+    }
+
+    // an exact mantissa and power of ten give a correctly rounded double.
+    // rounding that to float is only unsafe if it lands exactly halfway
+    // between two floats, so anything else can skip strtof
+    if (!dropped && mantissa < (1ull << 53) && frac <= 22) {
+        double d = (double) mantissa / POW10[frac];
+        uint64_t dbits;
+        memcpy(&dbits, &d, sizeof(dbits));
+        if (d == 0.0 || (d >= FLT_MIN && d <= FLT_MAX &&
+                         (dbits & 0x1fffffff) != 0x10000000)) {
+            float f = (float) d;
+            return lval_float(neg ? -f : f);
+        }
+    }
+
     errno = 0;
-    float x = strtof(t->contents, NULL);
+    float x = strtof(start, NULL);
     return errno != ERANGE ?
         lval_float(x) : lval_err("invalid float");
 }
 
+// STRING ESCAPES
+// the same escapes as mpcf_escape and mpcf_unescape, but clean runs of
+// characters are found 16 or 32 bytes at a time and copied in bulk rather
+// than appended one character and one realloc at a time
+
+// escape sequence letter for each byte that needs one, 0 otherwise
+static const char lstr_escapes[256] = {
+    ['\a'] = 'a', ['\b'] = 'b', ['\f'] = 'f', ['\n'] = 'n', ['\r'] = 'r',
+    ['\t'] = 't', ['\v'] = 'v', ['\\'] = '\\', ['\''] = '\'', ['\"'] = '"',
+    ['\0'] = '0'
+};
+
+// byte for the escape sequence letter after a backslash, -1 if not an escape
+int lstr_unescape_char(char c) {
+    switch (c) {
+        case 'a': return '\a';
+        case 'b': return '\b';
+        case 'f': return '\f';
+        case 'n': return '\n';
+        case 'r': return '\r';
+        case 't': return '\t';
+        case 'v': return '\v';
+        case '\\': return '\\';
+        case '\'': return '\'';
+        case '"': return '"';
+        case '0': return '\0';
+    }
+    return -1;
+}
+
+// index of the first byte of p that needs escaping, or n
+int lstr_escape_scan_scalar(const char* p, int n) {
+    int i = 0;
+    while (i < n && !lstr_escapes[(unsigned char) p[i]]) { i++; }
+    return i;
+}
+
+#ifdef LSTR_SIMD
+// bytes \a to \r are the range 7..13, the rest are tested one by one
+int lstr_escape_scan_sse2(const char* p, int n) {
+    __m128i lo = _mm_set1_epi8(7);
+    __m128i width = _mm_set1_epi8(6);
+    __m128i bs = _mm_set1_epi8('\\');
+    __m128i sq = _mm_set1_epi8('\'');
+    __m128i dq = _mm_set1_epi8('"');
+    __m128i nul = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*) (p + i));
+        __m128i d = _mm_sub_epi8(x, lo);
+        __m128i m = _mm_cmpeq_epi8(_mm_min_epu8(d, width), d);
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(x, bs));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(x, sq));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(x, dq));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(x, nul));
+        unsigned int mask = _mm_movemask_epi8(m);
+        if (mask) { return i + __builtin_ctz(mask); }
+    }
+    return i + lstr_escape_scan_scalar(p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+int lstr_escape_scan_avx2(const char* p, int n) {
+    __m256i lo = _mm256_set1_epi8(7);
+    __m256i width = _mm256_set1_epi8(6);
+    __m256i bs = _mm256_set1_epi8('\\');
+    __m256i sq = _mm256_set1_epi8('\'');
+    __m256i dq = _mm256_set1_epi8('"');
+    __m256i nul = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*) (p + i));
+        __m256i d = _mm256_sub_epi8(x, lo);
+        __m256i m = _mm256_cmpeq_epi8(_mm256_min_epu8(d, width), d);
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, bs));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, sq));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, dq));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, nul));
+        unsigned int mask = _mm256_movemask_epi8(m);
+        if (mask) { return i + __builtin_ctz(mask); }
+    }
+    return i + lstr_escape_scan_sse2(p + i, n - i);
+}
+#endif
+
+static int (*lstr_escape_scan)(const char*, int) = lstr_escape_scan_scalar;
+
+// build a string from the n bytes of a literal between its quotes
+lval* lval_str_unescape(const char* p, int n) {
+    // unescaping only ever shrinks the string
+    char* out = malloc(n + 1);
+    int len = 0;
+    int i = 0;
+    while (i < n) {
+        // memchr is already vectorized by the C library
+        const char* bs = memchr(p + i, '\\', n - i);
+        int run = bs ? (int) (bs - (p + i)) : n - i;
+        memcpy(out + len, p + i, run);
+        len += run;
+        i += run;
+        if (i == n) { break; }
+
+        // a backslash that does not start an escape is kept as it is
+        int c = i + 1 < n ? lstr_unescape_char(p[i+1]) : -1;
+        out[len++] = c < 0 ? '\\' : c;
+        i += c < 0 ? 1 : 2;
+    }
+    out[len] = '\0';
+    return lval_str_own(out, len);
+}
+
 lval* lval_read_str(mpc_ast_t* t) {
-    // cut off the final quote char
-    t->contents[strlen(t->contents)-1] = '\0';
-    // copy the string missing out the first quote character
-    char* unescaped = malloc(strlen(t->contents+1)+1);
-    strcpy(unescaped, t->contents+1);
-    // pass through the unescape function
-    unescaped = mpcf_unescape(unescaped);
-    // construct a new lval using the string
-    lval* str = lval_str(unescaped);
-    // free the string and return
-    free(unescaped);
-    return str;
+    // skip the surrounding quotes
+    return lval_str_unescape(t->contents + 1, (int) strlen(t->contents) - 2);
 }
 
 // lval read
 lval* lval_read(mpc_ast_t* t) {
     // if symbol or number return conversion to that type
-    if (strstr(t->tag, "int")) { return lval_read_int(t); }
-    if (strstr(t->tag, "float")) { return lval_read_float(t); }
+    if (strstr(t->tag, "int") || strstr(t->tag, "float")) {
+        return lval_read_num(t->contents);
+    }
     if (strstr(t->tag, "symbol")) { return lval_sym(t->contents); }
 
     // string reading
@@ -360,6 +1092,325 @@ lval* lval_read(mpc_ast_t* t) {
     return x;
 }
 
+// DIRECT READER
+// reads source text into lvals in a single pass without building an mpc AST.
+// it follows the grammar given to mpca_lang in main, trying float, int,
+// symbol, sexpr, qexpr, string and comment in the same order, so both
+// readers agree on every input. errors carry the line and column like mpc's.
+// building with -DSLITHER_MPC_READER switches back to the mpc grammar
+
+enum { LSRC_SPACE = 1, LSRC_DIGIT = 2, LSRC_SYM = 4 };
+
+// character classes, filled in by lsrc_init
+static unsigned char lsrc_class[256];
+
+void lsrc_init(void) {
+    const char* sym = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                      "0123456789_+-*/\\=<>!&|%^";
+    for (const char* c = sym; *c; c++) { lsrc_class[(unsigned char) *c] |= LSRC_SYM; }
+    for (const char* c = "0123456789"; *c; c++) { lsrc_class[(unsigned char) *c] |= LSRC_DIGIT; }
+    for (const char* c = " \f\n\r\t\v"; *c; c++) { lsrc_class[(unsigned char) *c] |= LSRC_SPACE; }
+}
+
+// position in the source being read
+typedef struct {
+    const char* filename;
+    const char* p;
+    const char* end;
+    const char* line;
+    int row;
+    lval* err;
+} lsrc;
+
+// record a syntax error at the current position, in the same form as
+// mpc_err_string, and return NULL
+lval* lsrc_err(lsrc* s, char* expected) {
+    char found[16];
+    if (s->p == s->end) {
+        strcpy(found, "end of input");
+    } else if (lstr_escapes[(unsigned char) *s->p]) {
+        sprintf(found, "'\\%c'", lstr_escapes[(unsigned char) *s->p]);
+    } else {
+        sprintf(found, "'%c'", *s->p);
+    }
+    s->err = lval_err("%s:%i:%i: error: expected %s at %s", s->filename, s->row,
+                      (int) (s->p - s->line) + 1, expected, found);
+    return NULL;
+}
+
+// skip whitespace and comments
+void lsrc_skip(lsrc* s) {
+    while (s->p < s->end) {
+        if (*s->p == ';') {
+            while (s->p < s->end && *s->p != '\n' && *s->p != '\r') { s->p++; }
+        } else if (lsrc_class[(unsigned char) *s->p] & LSRC_SPACE) {
+            if (*s->p == '\n') { s->row++; s->line = s->p + 1; }
+            s->p++;
+        } else {
+            return;
+        }
+    }
+}
+
+// -?[0-9]+ with an optional .[0-9]+ after it
+lval* lsrc_num(lsrc* s) {
+    const char* start = s->p;
+    if (*s->p == '-') { s->p++; }
+    while (s->p < s->end && lsrc_class[(unsigned char) *s->p] & LSRC_DIGIT) { s->p++; }
+    if (s->p < s->end && *s->p == '.') {
+        s->p++;
+        if (s->p == s->end || !(lsrc_class[(unsigned char) *s->p] & LSRC_DIGIT)) {
+            return lsrc_err(s, "digit");
+        }
+        while (s->p < s->end && lsrc_class[(unsigned char) *s->p] & LSRC_DIGIT) { s->p++; }
+    }
+
+    // lval_read_num wants a terminated string
+    int n = (int) (s->p - start);
+    char buf[64];
+    char* num = n < 64 ? buf : malloc(n + 1);
+    memcpy(num, start, n);
+    num[n] = '\0';
+    lval* x = lval_read_num(num);
+    if (num != buf) { free(num); }
+    return x;
+}
+
+// a quoted string, where a backslash escapes any character after it
+lval* lsrc_str(lsrc* s) {
+    const char* start = ++s->p;
+    while (s->p < s->end && *s->p != '"') {
+        if (*s->p == '\\' && s->p + 1 < s->end) { s->p++; }
+        if (*s->p == '\n') { s->row++; s->line = s->p + 1; }
+        s->p++;
+    }
+    if (s->p == s->end) { return lsrc_err(s, "'\"'"); }
+    s->p++;
+    return lval_str_unescape(start, (int) (s->p - start) - 1);
+}
+
+// a number, symbol or string, or NULL when there is none at this position
+// or there was an error reading it
+lval* lsrc_atom(lsrc* s) {
+    if (s->p == s->end) { return NULL; }
+    unsigned char c = *s->p;
+    unsigned char next = s->p + 1 < s->end ? s->p[1] : 0;
+    if ((lsrc_class[c] & LSRC_DIGIT) || (c == '-' && (lsrc_class[next] & LSRC_DIGIT))) {
+        return lsrc_num(s);
+    }
+    if (lsrc_class[c] & LSRC_SYM) {
+        const char* start = s->p;
+        while (s->p < s->end && lsrc_class[(unsigned char) *s->p] & LSRC_SYM) { s->p++; }
+        return lval_sym_n(start, (int) (s->p - start));
+    }
+    if (c == '"') { return lsrc_str(s); }
+    return NULL;
+}
+
+// a list that has been opened but not yet closed
+typedef struct {
+    lval* list;
+    char close;
+} lsrc_open;
+
+// the next expression, or NULL when there is none at this position or
+// there was an error reading it. open lists are kept on a stack rather
+// than read by recursion, so how deeply they nest is limited only by memory
+lval* lsrc_expr(lsrc* s) {
+    lsrc_open stk[64];
+    lsrc_open* open = stk;
+    int depth = 0;
+    int slots = 64;
+    lval* y;
+
+    while (1) {
+        if (s->p < s->end && (*s->p == '(' || *s->p == '{')) {
+            if (depth == slots) {
+                slots *= 2;
+                if (open == stk) {
+                    open = malloc(sizeof(lsrc_open) * slots);
+                    memcpy(open, stk, sizeof(stk));
+                } else {
+                    open = realloc(open, sizeof(lsrc_open) * slots);
+                }
+            }
+            open[depth].list = *s->p == '(' ? lval_sexpr() : lval_qexpr();
+            open[depth].close = *s->p == '(' ? ')' : '}';
+            depth++;
+            s->p++;
+            y = NULL;
+        } else if (!(y = lsrc_atom(s))) {
+            if (depth && !s->err) {
+                lsrc_err(s, open[depth-1].close == ')' ? "expression or ')'" : "expression or '}'");
+            }
+            while (depth) { lval_del(open[--depth].list); }
+            break;
+        }
+
+        // add what was read to the list it is in, closing any lists that
+        // end after it, until another expression is due
+        while (1) {
+            if (y && depth == 0) { break; }
+            if (y) { lval_add(open[depth-1].list, y); }
+            lsrc_skip(s);
+            y = NULL;
+            if (s->p < s->end && *s->p == open[depth-1].close) {
+                s->p++;
+                y = open[--depth].list;
+                continue;
+            }
+            break;
+        }
+        if (y) { break; }
+    }
+
+    if (open != stk) { free(open); }
+    return y;
+}
+
+// the next top-level expression, or NULL at the end or on an error
+lval* lsrc_next(lsrc* s) {
+    lsrc_skip(s);
+    if (s->p == s->end) { return NULL; }
+    lval* y = lsrc_expr(s);
+    if (!y && !s->err) { lsrc_err(s, "expression or end of input"); }
+    return y;
+}
+
+// read every expression in n bytes of source into an sexpr, or an error
+lval* lval_read_src(const char* filename, const char* src, int n) {
+    lsrc s = { filename, src, src + n, src, 1, NULL };
+    lval* x = lval_sexpr();
+    lval* y;
+    while ((y = lsrc_next(&s))) { lval_add(x, y); }
+    if (s.err) {
+        lval_del(x);
+        return s.err;
+    }
+    return x;
+}
+
+#ifdef SLITHER_MPC_READER
+// each thread keeps one input and resets it onto each new source rather
+// than making one per parse, since pmap workers read through load too
+static pthread_key_t read_input;
+static pthread_once_t read_input_once = PTHREAD_ONCE_INIT;
+
+void read_input_free(void* in) { mpc_input_delete(in); }
+
+void read_input_init(void) { pthread_key_create(&read_input, read_input_free); }
+#endif
+
+// read every expression in n bytes of source, or an error
+lval* lval_read_text(char* filename, char* src, int n) {
+#ifdef SLITHER_MPC_READER
+    pthread_once(&read_input_once, read_input_init);
+    mpc_input_t* in = pthread_getspecific(read_input);
+    if (in) {
+        mpc_input_reset_nstring(in, filename, src, n);
+    } else {
+        in = mpc_input_new_nstring(filename, src, n);
+        pthread_setspecific(read_input, in);
+    }
+    mpc_result_t r;
+    if (!mpc_parse_input(in, Slither, &r)) {
+        char* err_msg = mpc_err_string(r.error);
+        mpc_err_delete(r.error);
+        lval* err = lval_err("%s", err_msg);
+        free(err_msg);
+        return err;
+    }
+    lval* x = lval_read(r.output);
+    mpc_ast_delete(r.output);
+    return x;
+#else
+    return lval_read_src(filename, src, n);
+#endif
+}
+
+// a source file read one top-level expression at a time, so that load can
+// evaluate each before reading the next. the mpc reader has to read the
+// whole file up front, so then the expressions are handed out from forms
+typedef struct {
+    lsrc src;
+    char* data;
+    size_t len;
+    int mapped;
+    lval* forms;
+    int next;
+} lsrc_file;
+
+void lsrc_file_close(lsrc_file* f);
+
+// open a file for reading, or return an error. regular files are mapped and
+// read in place, anything else is read in large blocks
+lval* lsrc_file_open(lsrc_file* f, char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) { return lval_err("%s: error: Unable to open file!", filename); }
+
+    f->data = NULL;
+    f->len = 0;
+    f->mapped = 0;
+    f->forms = NULL;
+    f->next = 0;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        char* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            f->data = data;
+            f->len = st.st_size;
+            f->mapped = 1;
+        }
+    }
+    if (!f->mapped) {
+        lbuf b = { NULL, 0, 0 };
+        char chunk[65536];
+        ssize_t n;
+        while ((n = read(fd, chunk, sizeof(chunk))) > 0) { lbuf_write(&b, chunk, n); }
+        f->data = b.data ? b.data : calloc(1, 1);
+        f->len = b.len;
+    }
+    close(fd);
+
+    lsrc s = { filename, f->data, f->data + f->len, f->data, 1, NULL };
+    f->src = s;
+#ifdef SLITHER_MPC_READER
+    f->forms = lval_read_text(filename, f->data, (int) f->len);
+    if (f->forms->type == LVAL_ERR) {
+        lval* err = f->forms;
+        f->forms = NULL;
+        lsrc_file_close(f);
+        return err;
+    }
+#endif
+    return NULL;
+}
+
+// the next top-level expression, or NULL at the end or on an error, which
+// is left in f->src.err
+lval* lsrc_file_next(lsrc_file* f) {
+    if (!f->forms) { return lsrc_next(&f->src); }
+    if (f->next == f->forms->count) { return NULL; }
+    lval* x = f->forms->cell[f->next];
+    f->forms->cell[f->next++] = NULL;
+    return x;
+}
+
+void lsrc_file_close(lsrc_file* f) {
+    if (f->forms) {
+        // anything not yet handed out still belongs to forms
+        for (int i = f->next; i < f->forms->count; i++) { lval_del(f->forms->cell[i]); }
+        f->forms->count = 0;
+        lval_del(f->forms);
+    }
+    if (f->mapped) {
+        munmap(f->data, f->len);
+    } else {
+        free(f->data);
+    }
+}
+
 // forward declaration of lval_print
 void lval_print(lval* v);
 
@@ -379,22 +1430,36 @@ void lval_expr_print(lval* v, char open, char close) {
 }
 
 void lval_print_str(lval* v) {
-    // make copy of the string
-    char* escaped = malloc(strlen(v->str)+1);
-    strcpy(escaped, v->str);
-    // pass it through the escape function
-    escaped = mpcf_escape(escaped);
-    // print it between " characters
-    printf("\"%s\"", escaped);
-    // free the copied string
-    free(escaped);
+    // print between " characters, writing clean runs straight out
+    putchar('"');
+    int i = 0;
+    while (i < v->slen) {
+        int run = lstr_escape_scan(v->str + i, v->slen - i);
+        fwrite(v->str + i, 1, run, stdout);
+        i += run;
+        if (i == v->slen) { break; }
+        putchar('\\');
+        putchar(lstr_escapes[(unsigned char) v->str[i]]);
+        i++;
+    }
+    putchar('"');
+}
+
+void lval_print_int(lval* v) {
+    char buf[16];
+    fwrite(buf, 1, lval_fmt_int(v->integer, buf), stdout);
+}
+
+void lval_print_float(lval* v) {
+    char buf[64];
+    fwrite(buf, 1, lval_fmt_float(v->ffloat, buf), stdout);
 }
 
 // print an lval
 void lval_print(lval* v) {
     switch (v->type) {
-        case LVAL_INT: printf("%i", v->integer); break;
-        case LVAL_FLOAT: printf("%f", v->ffloat); break;
+        case LVAL_INT: lval_print_int(v); break;
+        case LVAL_FLOAT: lval_print_float(v); break;
         case LVAL_FUN:
             if (v->builtin) {
                 printf("<builtin>");
@@ -411,6 +1476,45 @@ void lval_print(lval* v) {
         case LVAL_SEXPR: lval_expr_print(v, '(', ')'); break;
         case LVAL_QEXPR: lval_expr_print(v, '{', '}'); break;
         case LVAL_STR: lval_print_str(v); break;
+        case LVAL_RANGE:
+            printf("<range %i %i %i>", v->start, v->stop, v->step);
+        break;
+        case LVAL_LAZY: printf("<lazy>"); break;
+        case LVAL_MAP:
+            printf("<map");
+            ltable_read(&v->map->lock);
+            for (int i = 0; i < v->map->cap; i++) {
+                lmap_entry* en = &v->map->entries[i];
+                if (!lmap_live(en)) { continue; }
+                printf(" {");
+                lval_print(en->key);
+                putchar(' ');
+                lval_print(en->val);
+                putchar('}');
+            }
+            ltable_done(&v->map->lock);
+            putchar('>');
+        break;
+        case LVAL_SORTED_MAP: {
+            // print the pairs in key order
+            lval* pairs = lval_qexpr();
+            ltable_read(&v->tree->lock);
+            lbnode_scan(v->tree->root, NULL, NULL, pairs);
+            ltable_done(&v->tree->lock);
+            printf("<sorted-map");
+            for (int i = 0; i < pairs->count; i++) {
+                putchar(' ');
+                lval_print(pairs->cell[i]);
+            }
+            putchar('>');
+            lval_del(pairs);
+        }
+        break;
+        case LVAL_SBUILDER:
+            ltable_read(&v->sb->lock);
+            printf("<string-builder %zu>", v->sb->buf.len);
+            ltable_done(&v->sb->lock);
+        break;
     }
 }
 
@@ -457,6 +1561,34 @@ lval* lval_copy(lval* v) {
         break;
         case LVAL_INT: x->integer = v->integer; break;
         case LVAL_FLOAT: x->ffloat = v->ffloat; break;
+        case LVAL_RANGE:
+            x->start = v->start;
+            x->stop = v->stop;
+            x->step = v->step;
+        break;
+        case LVAL_LAZY:
+            x->source = lval_copy(v->source);
+            x->lines = v->lines;
+            x->stage_count = v->stage_count;
+            x->stages = malloc(sizeof(lstage) * v->stage_count);
+            for (int i = 0; i < v->stage_count; i++) {
+                x->stages[i] = v->stages[i];
+                if (v->stages[i].fn) { x->stages[i].fn = lval_copy(v->stages[i].fn); }
+            }
+        break;
+        case LVAL_MAP:
+            // maps are shared rather than copied
+            x->map = v->map;
+            __sync_fetch_and_add(&x->map->refs, 1);
+        break;
+        case LVAL_SORTED_MAP:
+            x->tree = v->tree;
+            __sync_fetch_and_add(&x->tree->refs, 1);
+        break;
+        case LVAL_SBUILDER:
+            x->sb = v->sb;
+            __sync_fetch_and_add(&x->sb->refs, 1);
+        break;
 
         // copy strings using malloc and strcpy
         case LVAL_ERR:
@@ -478,9 +1610,18 @@ lval* lval_copy(lval* v) {
                 x->cell[i] = lval_copy(v->cell[i]);
             }
         break;
+        // copy short strings inline, longer ones share the buffer
         case LVAL_STR:
-            x->str = malloc(strlen(v->str) + 1);
-            strcpy(x->str, v->str);
+            if (v->str == v->sso) {
+                x->str = x->sso;
+                memcpy(x->sso, v->sso, v->slen + 1);
+            } else {
+                x->sbase = v->sbase;
+                __sync_fetch_and_add(&x->sbase->refs, 1);
+                x->str = v->str;
+            }
+            x->slen = v->slen;
+            x->shash = v->shash;
         break;
     }
     return x;
@@ -488,14 +1629,20 @@ lval* lval_copy(lval* v) {
 
 // get a value from the environment
 lval* lenv_get(lenv* e, lval* k) {
+    int shared = lenv_shared && !e->par;
+    if (shared) { pthread_rwlock_rdlock(&lenv_lock); }
+
     // iterate over all items in environment
     for (int i = 0; i < e->count; i++) {
         // check if the stored string matches the symbol string
         // if it does, return a copy of the value
         if (strcmp(e->syms[i], k->sym) == 0) {
-            return lval_copy(e->vals[i]);
+            lval* x = lval_copy(e->vals[i]);
+            if (shared) { pthread_rwlock_unlock(&lenv_lock); }
+            return x;
         }
     }
+    if (shared) { pthread_rwlock_unlock(&lenv_lock); }
     // if no symbol found check for in parent otherwise return error
     if (e->par) {
         return lenv_get(e->par, k);
@@ -520,6 +1667,9 @@ lenv* lenv_copy(lenv* e) {
 
 // put a new variable into the environment
 void lenv_put(lenv* e, lval* k, lval* v) {
+    int shared = lenv_shared && !e->par;
+    if (shared) { pthread_rwlock_wrlock(&lenv_lock); }
+
     // iterate over all items in environment
     // this is to see if variable already exists
     for (int i = 0; i < e->count; i++) {
@@ -528,6 +1678,7 @@ void lenv_put(lenv* e, lval* k, lval* v) {
         if (strcmp(e->syms[i], k->sym) == 0) {
             lval_del(e->vals[i]);
             e->vals[i] = lval_copy(v);
+            if (shared) { pthread_rwlock_unlock(&lenv_lock); }
             return;
         }
     }
@@ -541,6 +1692,7 @@ void lenv_put(lenv* e, lval* k, lval* v) {
     e->vals[e->count-1] = lval_copy(v);
     e->syms[e->count-1] = malloc(strlen(k->sym)+1);
     strcpy(e->syms[e->count-1], k->sym);
+    if (shared) { pthread_rwlock_unlock(&lenv_lock); }
 }
 
 void lenv_def(lenv* e, lval* k, lval* v) {
@@ -626,7 +1778,7 @@ lval* builtin_op(lenv* e, lval* a, char* op) {
                 break;
             }
             if (strcmp(op, "/") == 0) {
-                if (y->integer == 0) {
+                if (y->ffloat == 0) {
                     lval_del(x);
                     lval_del(y);
                     x = lval_err("Division by Zero!"); break;
@@ -647,7 +1799,7 @@ lval* builtin_op(lenv* e, lval* a, char* op) {
                 break;
             }
             if (strcmp(op, "/") == 0) {
-                if (y->integer == 0) {
+                if (y->ffloat == 0) {
                     lval_del(x);
                     lval_del(y);
                     x = lval_err("Division by Zero!"); break;
@@ -669,41 +1821,34 @@ lval* builtin_load(lenv* e, lval* a) {
     LASSERT_NUM("load", a, 1);
     LASSERT_TYPE("load", a, 0, LVAL_STR);
 
-    // parse file given by string name
-    mpc_result_t r;
-    if (mpc_parse_contents(a->cell[0]->str, Slither, &r)) {
-
-        // read contents
-        lval* expr = lval_read(r.output);
-        mpc_ast_delete(r.output);
+    // open file given by string name
+    lsrc_file f;
+    lval* err = lsrc_file_open(&f, lval_cstr(a->cell[0]));
+    if (!err) {
 
-        // evaluate each expression
-        while (expr->count) {
-            lval* x = lval_eval(e, lval_pop(expr, 0));
+        // read and evaluate one expression at a time
+        lval* expr;
+        while ((expr = lsrc_file_next(&f))) {
+            lval* x = lval_eval(e, expr);
             // if evaluation leads to error print it
             if (x->type == LVAL_ERR) { lval_println(x); }
             lval_del(x);
         }
+        err = f.src.err;
+        lsrc_file_close(&f);
+    }
+    lval_del(a);
 
-        // delete expressions and arguments
-        lval_del(expr);
-        lval_del(a);
-
-        // return empty list
-        return lval_sexpr();
-    } else {
-        // get parse error as string
-        char* err_msg = mpc_err_string(r.error);
-        mpc_err_delete(r.error);
-
-        // create new error message using it
-        lval* err = lval_err("Could not load library %s", err_msg);
-        free(err_msg);
-        lval_del(a);
-
-        // cleanup and return error
-        return err;
+    // a syntax error stops the load at the expression it is in
+    if (err) {
+        // create new error message from the parse error
+        lval* x = lval_err("Could not load library %s", err->err);
+        lval_del(err);
+        return x;
     }
+
+    // return empty list
+    return lval_sexpr();
 }
 
 lval* builtin_add(lenv* e, lval* a) {
@@ -731,16 +1876,28 @@ lval* builtin_head(lenv* e, lval* a) {
             "Function 'head' passed too many args. "
             "Got %i, Expected %i.",
             a->count, 1);
-    LASSERT(a, (a->cell[0]->type == LVAL_QEXPR || a->cell[0]->type == LVAL_STR),
+    LASSERT(a, (a->cell[0]->type == LVAL_QEXPR || a->cell[0]->type == LVAL_STR ||
+                a->cell[0]->type == LVAL_RANGE),
             "Function 'head' passed incorrect type for arg 0. "
-            "Got %s, Expected %s or %s.",
-            ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR), ltype_name(LVAL_STR));
+            "Got %s, Expected %s, %s or %s.",
+            ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR), ltype_name(LVAL_STR),
+            ltype_name(LVAL_RANGE));
     if (a->cell[0]->type == LVAL_QEXPR) {
         LASSERT_NOT_EMPTY("head", a, 0);
     }
 
+    if (a->cell[0]->type == LVAL_RANGE) {
+        LASSERT(a, lval_range_len(a->cell[0]) != 0,
+                "Function 'head' passed an empty range for argument 0.");
+        lval* v = lval_add(lval_qexpr(), lval_int(a->cell[0]->start));
+        lval_del(a);
+        return v;
+    }
+
     if (a->cell[0]->type == LVAL_STR) {
-        lval* v = lval_str(&a->cell[0]->str[0]);
+        // the first character, or "" for the empty string
+        lval* x = a->cell[0];
+        lval* v = lval_str_n(x->str, x->slen > 0);
         lval_del(a);
         return v;
     }
@@ -757,18 +1914,29 @@ lval* builtin_tail(lenv* e, lval* a) {
             "Function 'tail' too many args. "
             "Got %i, Expected %i.",
             a->count, 1);
-    LASSERT(a, (a->cell[0]->type == LVAL_QEXPR || a->cell[0]->type == LVAL_STR),
+    LASSERT(a, (a->cell[0]->type == LVAL_QEXPR || a->cell[0]->type == LVAL_STR ||
+                a->cell[0]->type == LVAL_RANGE),
             "Function 'tail' passed incorrect type for arg 0. "
-            "Got %s, Expected %s or %s.",
+            "Got %s, Expected %s, %s or %s.",
             ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR),
-            ltype_name(LVAL_STR));
+            ltype_name(LVAL_STR), ltype_name(LVAL_RANGE));
     if (a->cell[0]->type == LVAL_QEXPR) {
         LASSERT_NOT_EMPTY("tail", a, 0);
     }
 
+    if (a->cell[0]->type == LVAL_RANGE) {
+        LASSERT(a, lval_range_len(a->cell[0]) != 0,
+                "Function 'tail' passed an empty range for argument 0.");
+        // move the start along one step, or onto stop if that was the last value
+        lval* v = lval_take(a, 0);
+        v->start = lval_range_len(v) == 1 ? v->stop : v->start + v->step;
+        return v;
+    }
+
     if (a->cell[0]->type == LVAL_STR) {
-        // make a new lval with the string starting from element 1 to the end
-        lval* v = lval_str(&a->cell[0]->str[1]);
+        // a slice of the string from element 1 to the end, sharing its buffer
+        lval* x = a->cell[0];
+        lval* v = lval_str_slice(x, x->slen > 0, x->slen > 0 ? x->slen - 1 : 0);
         lval_del(a);
         return v;
     }
@@ -784,21 +1952,24 @@ lval* builtin_tail(lenv* e, lval* a) {
 
 lval* builtin_len(lenv* e, lval* a) {
     LASSERT(a, (a->cell[0]->type == LVAL_QEXPR) ||
-        (a->cell[0]->type == LVAL_STR),
+        (a->cell[0]->type == LVAL_STR) || (a->cell[0]->type == LVAL_RANGE) ||
+        (a->cell[0]->type == LVAL_LAZY),
         "Function 'len' passed the wrong type for arg 0 "
-        "Got %s, Expected %s or %s.",
-        ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR), ltype_name(LVAL_STR));
+        "Got %s, Expected %s, %s, %s or %s.",
+        ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR), ltype_name(LVAL_STR),
+        ltype_name(LVAL_RANGE), ltype_name(LVAL_LAZY));
     LASSERT(a, a->count == 1,
         "Function 'len' passed too many args. "
         "Got %i, Expected %i.",
         a->count, 1);
     // @TODO: will i need to clean memory for this one? not sure
     if (a->cell[0]->type == LVAL_STR) {
-        int size = (int) strlen(a->cell[0]->str);
+        int size = a->cell[0]->slen;
         lval_del(a);
         return lval_int(size);
     }
-    lval* x = lval_int(a->cell[0]->count);
+    // a lazy sequence has to be run to be counted
+    lval* x = lval_seq_count(e, a->cell[0]);
     // @TODO: should I delete a?
     // TODO: really see if deleting a is needed
     // I don't think so because we might still need it?
@@ -806,13 +1977,59 @@ lval* builtin_len(lenv* e, lval* a) {
     return x;
 }
 
+lval* builtin_range(lenv* e, lval* a) {
+    LASSERT(a, a->count >= 1 && a->count <= 3,
+            "Function 'range' passed incorrect number of arguments. "
+            "Got %i, Expected 1 to 3.", a->count);
+    for (int i = 0; i < a->count; i++) {
+        LASSERT_TYPE("range", a, i, LVAL_INT);
+    }
+
+    // (range stop), (range start stop) or (range start stop step)
+    int start = a->count == 1 ? 0 : a->cell[0]->integer;
+    int stop = a->count == 1 ? a->cell[0]->integer : a->cell[1]->integer;
+    int step = a->count == 3 ? a->cell[2]->integer : 1;
+    LASSERT(a, step != 0, "Function 'range' passed a step of 0.");
+    LASSERT(a, lrange_count(start, stop, step) <= INT_MAX,
+            "Function 'range' passed a range too long to count. "
+            "Got %lld items, Expected at most %i.",
+            lrange_count(start, stop, step), INT_MAX);
+
+    lval_del(a);
+    return lval_range(start, stop, step);
+}
+
+lval* builtin_nth(lenv* e, lval* a) {
+    LASSERT_NUM("nth", a, 2);
+    LASSERT_TYPE("nth", a, 0, LVAL_INT);
+    LASSERT_SEQ("nth", a, 1);
+
+    int n = a->cell[0]->integer;
+    if (n >= 0 && a->cell[1]->type == LVAL_LAZY) {
+        // run a lazy sequence only as far as item n
+        lval* x = lval_seq_take(e, a->cell[1], n < INT_MAX ? n + 1 : n);
+        lval_del(a->cell[1]);
+        a->cell[1] = x;
+        if (x->type == LVAL_ERR) { return lval_take(a, 1); }
+    }
+    LASSERT(a, n >= 0 && n < lval_seq_len(a->cell[1]),
+            "Function 'nth' passed index %i out of range for length %i.",
+            n, lval_seq_len(a->cell[1]));
+
+    lval* x = lval_seq_nth(a->cell[1], n);
+    lval_del(a);
+    return x;
+}
+
 lval* builtin_list(lenv* e, lval* a) {
     a->type = LVAL_QEXPR;
     return a;
 }
 
 lval* builtin_show(lenv* e, lval* a) {
-    printf("%s", a->cell[0]->str);
+    LASSERT_NUM("show", a, 1);
+    LASSERT_TYPE("show", a, 0, LVAL_STR);
+    fwrite(a->cell[0]->str, 1, a->cell[0]->slen, stdout);
     putchar('\n');
     // just return an empty sexpr after printing cstring
     lval_del(a);
@@ -878,6 +2095,392 @@ lval* builtin_lte(lenv* e, lval* a) {
     return builtin_ord(e, a, "<=");
 }
 
+// HASH MAPS
+// an LVAL_MAP points at a shared, reference counted table so that the
+// copies made by lenv_get and friends all see the same mutable map.
+// keys are any lval, hashed structurally and compared with lval_eq, and
+// stored by open addressing with linear probing
+
+// FNV-1a over a block of bytes
+unsigned int hash_bytes(const void* p, size_t n, unsigned int h) {
+    const unsigned char* b = p;
+    for (size_t i = 0; i < n; i++) { h = (h ^ b[i]) * 16777619u; }
+    return h;
+}
+
+// hash of a string's bytes, computed once and cached in the lval
+unsigned int lval_str_hash(lval* v) {
+    if (v->shash == 0) {
+        unsigned int h = hash_bytes(v->str, v->slen, 2166136261u);
+        // 0 marks the hash as not yet computed
+        v->shash = h ? h : 1;
+    }
+    return v->shash;
+}
+
+// structural hash, values equal under lval_eq_num always hash the same
+unsigned int lval_hash(lval* v) {
+    if (v->type == LVAL_FLOAT && v->ffloat >= INT_MIN && v->ffloat < -(double) INT_MIN &&
+        v->ffloat == (int) v->ffloat) {
+        // a whole float equals the int of the same value, so hashes as it.
+        // this also makes +0.0 and -0.0 hash alike
+        int i = (int) v->ffloat;
+        int type = LVAL_INT;
+        return hash_bytes(&i, sizeof(int), hash_bytes(&type, sizeof(int), 2166136261u));
+    }
+    unsigned int h = hash_bytes(&v->type, sizeof(int), 2166136261u);
+    switch (v->type) {
+        case LVAL_INT: return hash_bytes(&v->integer, sizeof(int), h);
+        case LVAL_FLOAT: return hash_bytes(&v->ffloat, sizeof(float), h);
+        case LVAL_ERR: return hash_bytes(v->err, strlen(v->err), h);
+        case LVAL_SYM: return hash_bytes(v->sym, strlen(v->sym), h);
+        case LVAL_STR: return (h ^ lval_str_hash(v)) * 16777619u;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            for (int i = 0; i < v->count; i++) { h = (h ^ lval_hash(v->cell[i])) * 16777619u; }
+            return h;
+        case LVAL_RANGE: {
+            // only what decides the values produced, as lval_eq does
+            int n = lval_range_len(v);
+            h = hash_bytes(&n, sizeof(int), h);
+            if (n > 0) { h = hash_bytes(&v->start, sizeof(int), h); }
+            if (n > 1) { h = hash_bytes(&v->step, sizeof(int), h); }
+            return h;
+        }
+        case LVAL_MAP: return hash_bytes(&v->map->count, sizeof(int), h);
+        case LVAL_SORTED_MAP: return hash_bytes(&v->tree->count, sizeof(int), h);
+        case LVAL_SBUILDER:
+            ltable_read(&v->sb->lock);
+            h = hash_bytes(v->sb->buf.data, v->sb->buf.len, h);
+            ltable_done(&v->sb->lock);
+            return h;
+    }
+    return h;
+}
+
+lmap* lmap_new(int cap) {
+    lmap* m = malloc(sizeof(lmap));
+    m->refs = 1;
+    pthread_rwlock_init(&m->lock, NULL);
+    m->count = 0;
+    m->used = 0;
+    m->cap = cap;
+    m->entries = calloc(cap, sizeof(lmap_entry));
+    return m;
+}
+
+void lmap_release(lmap* m) {
+    if (__sync_sub_and_fetch(&m->refs, 1) != 0) { return; }
+    for (int i = 0; i < m->cap; i++) {
+        if (lmap_live(&m->entries[i])) {
+            lval_del(m->entries[i].key);
+            lval_del(m->entries[i].val);
+        }
+    }
+    free(m->entries);
+    pthread_rwlock_destroy(&m->lock);
+    free(m);
+}
+
+// slot holding key k, or -1 if it is not in the map
+int lmap_find(lmap* m, lval* k, unsigned int h) {
+    for (int i = h & (m->cap - 1); m->entries[i].key; i = (i + 1) & (m->cap - 1)) {
+        lmap_entry* en = &m->entries[i];
+        if (en->key != &lmap_tombstone && en->hash == h && lval_eq_num(en->key, k)) { return i; }
+    }
+    return -1;
+}
+
+// move every entry into a table of the given capacity, dropping tombstones
+void lmap_resize(lmap* m, int cap) {
+    lmap_entry* old = m->entries;
+    int old_cap = m->cap;
+    m->entries = calloc(cap, sizeof(lmap_entry));
+    m->cap = cap;
+    m->used = m->count;
+    for (int i = 0; i < old_cap; i++) {
+        if (!lmap_live(&old[i])) { continue; }
+        int j = old[i].hash & (cap - 1);
+        while (m->entries[j].key) { j = (j + 1) & (cap - 1); }
+        m->entries[j] = old[i];
+    }
+    free(old);
+}
+
+// insert or replace, taking ownership of k and v
+void lmap_put(lmap* m, lval* k, lval* v) {
+    unsigned int h = lval_hash(k);
+    int i = lmap_find(m, k, h);
+    if (i >= 0) {
+        lval_del(k);
+        lval_del(m->entries[i].val);
+        m->entries[i].val = v;
+        return;
+    }
+
+    // keep the table at most 70% full counting tombstones
+    if ((m->used + 1) * 10 > m->cap * 7) {
+        lmap_resize(m, m->count * 2 >= m->cap ? m->cap * 2 : m->cap);
+    }
+    for (i = h & (m->cap - 1); m->entries[i].key && m->entries[i].key != &lmap_tombstone;
+         i = (i + 1) & (m->cap - 1)) {}
+    if (!m->entries[i].key) { m->used++; }
+    m->entries[i].key = k;
+    m->entries[i].val = v;
+    m->entries[i].hash = h;
+    m->count++;
+}
+
+// remove a key, returns 0 if it was not present
+int lmap_del(lmap* m, lval* k) {
+    int i = lmap_find(m, k, lval_hash(k));
+    if (i < 0) { return 0; }
+    lval_del(m->entries[i].key);
+    lval_del(m->entries[i].val);
+    m->entries[i].key = &lmap_tombstone;
+    m->entries[i].val = NULL;
+    m->count--;
+    return 1;
+}
+
+// maps are equal if they hold equal values under the same keys
+int lmap_eq(lmap* a, lmap* b) {
+    if (a == b) { return 1; }
+    ltable_read(&a->lock);
+    ltable_read(&b->lock);
+    int eq = a->count == b->count;
+    for (int i = 0; i < a->cap && eq; i++) {
+        lmap_entry* en = &a->entries[i];
+        if (!lmap_live(en)) { continue; }
+        int j = lmap_find(b, en->key, en->hash);
+        eq = j >= 0 && lval_eq(en->val, b->entries[j].val);
+    }
+    ltable_done(&b->lock);
+    ltable_done(&a->lock);
+    return eq;
+}
+
+// construct a pointer to a new empty map lval
+lval* lval_map(void) {
+    lval* v = malloc(sizeof(lval));
+    v->type = LVAL_MAP;
+    v->map = lmap_new(8);
+    return v;
+}
+
+// total order over ints, floats and strings used by sorted maps. numbers
+// compare by value and sort before strings, strings compare bytewise
+int lval_cmp(lval* a, lval* b) {
+    int an = a->type == LVAL_INT || a->type == LVAL_FLOAT;
+    int bn = b->type == LVAL_INT || b->type == LVAL_FLOAT;
+    if (an && bn) {
+        if (a->type == LVAL_INT && b->type == LVAL_INT) {
+            return (a->integer > b->integer) - (a->integer < b->integer);
+        }
+        // cast each side, as int ? int : float would round the int to a float
+        double x = a->type == LVAL_INT ? (double) a->integer : a->ffloat;
+        double y = b->type == LVAL_INT ? (double) b->integer : b->ffloat;
+        return (x > y) - (x < y);
+    }
+    if (an != bn) { return an ? -1 : 1; }
+    int n = a->slen < b->slen ? a->slen : b->slen;
+    int c = memcmp(a->str, b->str, n);
+    if (c == 0) { return (a->slen > b->slen) - (a->slen < b->slen); }
+    return (c > 0) - (c < 0);
+}
+
+// SORTED MAPS
+// an LVAL_SORTED_MAP points at a shared, reference counted B-tree with
+// wide nodes, keyed by lval_cmp. like hash maps, copies share the tree
+
+lbnode* lbnode_new(int leaf) {
+    lbnode* n = malloc(sizeof(lbnode));
+    n->count = 0;
+    n->leaf = leaf;
+    return n;
+}
+
+void lbnode_del(lbnode* n) {
+    for (int i = 0; i < n->count; i++) {
+        lval_del(n->keys[i]);
+        lval_del(n->vals[i]);
+    }
+    if (!n->leaf) {
+        for (int i = 0; i <= n->count; i++) { lbnode_del(n->kids[i]); }
+    }
+    free(n);
+}
+
+lbtree* lbtree_new(void) {
+    lbtree* t = malloc(sizeof(lbtree));
+    t->refs = 1;
+    pthread_rwlock_init(&t->lock, NULL);
+    t->count = 0;
+    t->root = lbnode_new(1);
+    return t;
+}
+
+void lbtree_release(lbtree* t) {
+    if (__sync_sub_and_fetch(&t->refs, 1) != 0) { return; }
+    lbnode_del(t->root);
+    pthread_rwlock_destroy(&t->lock);
+    free(t);
+}
+
+// first position in a node whose key is >= k
+int lbnode_lower(lbnode* n, lval* k) {
+    int lo = 0, hi = n->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (lval_cmp(n->keys[mid], k) < 0) { lo = mid + 1; } else { hi = mid; }
+    }
+    return lo;
+}
+
+// value stored under k, or NULL
+lval* lbtree_get(lbtree* t, lval* k) {
+    lbnode* n = t->root;
+    while (1) {
+        int i = lbnode_lower(n, k);
+        if (i < n->count && lval_cmp(n->keys[i], k) == 0) { return n->vals[i]; }
+        if (n->leaf) { return NULL; }
+        n = n->kids[i];
+    }
+}
+
+// split the full child i of n in two, moving its middle key up into n
+void lbnode_split(lbnode* n, int i) {
+    lbnode* full = n->kids[i];
+    lbnode* right = lbnode_new(full->leaf);
+    right->count = BT_MIN_DEGREE - 1;
+    memcpy(right->keys, &full->keys[BT_MIN_DEGREE], sizeof(lval*) * (BT_MIN_DEGREE - 1));
+    memcpy(right->vals, &full->vals[BT_MIN_DEGREE], sizeof(lval*) * (BT_MIN_DEGREE - 1));
+    if (!full->leaf) {
+        memcpy(right->kids, &full->kids[BT_MIN_DEGREE], sizeof(lbnode*) * BT_MIN_DEGREE);
+    }
+    full->count = BT_MIN_DEGREE - 1;
+
+    memmove(&n->kids[i+2], &n->kids[i+1], sizeof(lbnode*) * (n->count - i));
+    memmove(&n->keys[i+1], &n->keys[i], sizeof(lval*) * (n->count - i));
+    memmove(&n->vals[i+1], &n->vals[i], sizeof(lval*) * (n->count - i));
+    n->kids[i+1] = right;
+    n->keys[i] = full->keys[BT_MIN_DEGREE - 1];
+    n->vals[i] = full->vals[BT_MIN_DEGREE - 1];
+    n->count++;
+}
+
+// insert or replace, taking ownership of k and v
+void lbtree_put(lbtree* t, lval* k, lval* v) {
+    lval* old = lbtree_get(t, k);
+    if (old) {
+        // find it again to swap the value in place
+        lbnode* n = t->root;
+        while (1) {
+            int i = lbnode_lower(n, k);
+            if (i < n->count && lval_cmp(n->keys[i], k) == 0) {
+                lval_del(n->vals[i]);
+                n->vals[i] = v;
+                lval_del(k);
+                return;
+            }
+            n = n->kids[i];
+        }
+    }
+
+    // split full nodes on the way down so there is always room to insert
+    if (t->root->count == BT_MAX_KEYS) {
+        lbnode* root = lbnode_new(0);
+        root->kids[0] = t->root;
+        t->root = root;
+        lbnode_split(root, 0);
+    }
+    lbnode* n = t->root;
+    while (!n->leaf) {
+        int i = lbnode_lower(n, k);
+        if (n->kids[i]->count == BT_MAX_KEYS) {
+            lbnode_split(n, i);
+            if (lval_cmp(n->keys[i], k) < 0) { i++; }
+        }
+        n = n->kids[i];
+    }
+    int i = lbnode_lower(n, k);
+    memmove(&n->keys[i+1], &n->keys[i], sizeof(lval*) * (n->count - i));
+    memmove(&n->vals[i+1], &n->vals[i], sizeof(lval*) * (n->count - i));
+    n->keys[i] = k;
+    n->vals[i] = v;
+    n->count++;
+    t->count++;
+}
+
+// the entry with the greatest key <= k (or smallest key >= k when ceil is
+// set) as a {key value} pair, or {} if there is none
+lval* lbtree_bound(lbtree* t, lval* k, int ceil) {
+    lbnode* n = t->root;
+    lval* key = NULL;
+    lval* val = NULL;
+    while (1) {
+        int i = lbnode_lower(n, k);
+        if (i < n->count && lval_cmp(n->keys[i], k) == 0) {
+            key = n->keys[i];
+            val = n->vals[i];
+            break;
+        }
+        if (ceil && i < n->count) { key = n->keys[i]; val = n->vals[i]; }
+        if (!ceil && i > 0) { key = n->keys[i-1]; val = n->vals[i-1]; }
+        if (n->leaf) { break; }
+        n = n->kids[i];
+    }
+    lval* x = lval_qexpr();
+    if (key) {
+        x = lval_add(x, lval_copy(key));
+        x = lval_add(x, lval_copy(val));
+    }
+    return x;
+}
+
+// append {key value} pairs with lo <= key < hi in order, NULL bounds are
+// open. returns 0 once a key past hi is seen so the walk can stop
+int lbnode_scan(lbnode* n, lval* lo, lval* hi, lval* out) {
+    for (int i = 0; i <= n->count; i++) {
+        // child i only holds keys below key i, skip it if they are all below lo
+        if (!n->leaf && (i == n->count || !lo || lval_cmp(n->keys[i], lo) >= 0)) {
+            if (!lbnode_scan(n->kids[i], lo, hi, out)) { return 0; }
+        }
+        if (i == n->count) { break; }
+        if (hi && lval_cmp(n->keys[i], hi) >= 0) { return 0; }
+        if (!lo || lval_cmp(n->keys[i], lo) >= 0) {
+            lval* pair = lval_add(lval_qexpr(), lval_copy(n->keys[i]));
+            lval_add(out, lval_add(pair, lval_copy(n->vals[i])));
+        }
+    }
+    return 1;
+}
+
+// sorted maps are equal if they hold the same pairs in the same order
+int lbtree_eq(lbtree* a, lbtree* b) {
+    if (a == b) { return 1; }
+    lval* x = lval_qexpr();
+    lval* y = lval_qexpr();
+    ltable_read(&a->lock);
+    lbnode_scan(a->root, NULL, NULL, x);
+    ltable_done(&a->lock);
+    ltable_read(&b->lock);
+    lbnode_scan(b->root, NULL, NULL, y);
+    ltable_done(&b->lock);
+    int eq = lval_eq(x, y);
+    lval_del(x);
+    lval_del(y);
+    return eq;
+}
+
+// construct a pointer to a new empty sorted map lval
+lval* lval_sorted_map(void) {
+    lval* v = malloc(sizeof(lval));
+    v->type = LVAL_SORTED_MAP;
+    v->tree = lbtree_new();
+    return v;
+}
+
 int lval_eq(lval* a, lval* b) {
 
     // if types do not line up then return 0 (false)
@@ -889,10 +2492,10 @@ int lval_eq(lval* a, lval* b) {
         case LVAL_FLOAT:
             return (a->ffloat == b->ffloat);
         case LVAL_SYM:
-            return (a->sym == b->sym);
+            return (strcmp(a->sym, b->sym) == 0);
         break;
         case LVAL_ERR:
-            return (a->err == b->err);
+            return (strcmp(a->err, b->err) == 0);
         case LVAL_SEXPR:
         case LVAL_QEXPR:
             // if counts of qexpr isnt the same 0 (false)
@@ -911,33 +2514,292 @@ int lval_eq(lval* a, lval* b) {
             }
         break;
         case LVAL_STR:
-            return (strcmp(a->str, b->str) == 0);
+            // lengths first, then hashes if both are already known
+            if (a->slen != b->slen) { return 0; }
+            if (a->shash && b->shash && a->shash != b->shash) { return 0; }
+            return memcmp(a->str, b->str, a->slen) == 0;
         break;
+        case LVAL_MAP:
+            return lmap_eq(a->map, b->map);
+        case LVAL_SORTED_MAP:
+            return lbtree_eq(a->tree, b->tree);
+        case LVAL_SBUILDER: {
+            if (a->sb == b->sb) { return 1; }
+            ltable_read(&a->sb->lock);
+            ltable_read(&b->sb->lock);
+            int eq = a->sb->buf.len == b->sb->buf.len &&
+                memcmp(a->sb->buf.data, b->sb->buf.data, a->sb->buf.len) == 0;
+            ltable_done(&b->sb->lock);
+            ltable_done(&a->sb->lock);
+            return eq;
+        }
+        case LVAL_RANGE: {
+            // ranges are equal if they produce the same values
+            int n = lval_range_len(a);
+            if (n != lval_range_len(b)) { return 0; }
+            if (n == 0) { return 1; }
+            return a->start == b->start && (n == 1 || a->step == b->step);
+        }
     }
     // if nothing else just return false
     return 0;
 }
 
+// equality as used by '==' and by both kinds of map for their keys. ints
+// and floats compare by exact value, as lval_cmp orders them
+int lval_eq_num(lval* a, lval* b) {
+    if (a->type == LVAL_INT && b->type == LVAL_FLOAT) {
+        return (double) a->integer == b->ffloat;
+    }
+    if (a->type == LVAL_FLOAT && b->type == LVAL_INT) {
+        return a->ffloat == (double) b->integer;
+    }
+    return lval_eq(a, b);
+}
+
 lval* builtin_cmp(lenv* e, lval* a, char* op) {
     LASSERT_NUM(op, a, 2);
-    LASSERT2TYPE(op, a, 0, LVAL_FLOAT, LVAL_INT);
-    LASSERT2TYPE(op, a, 1, LVAL_FLOAT, LVAL_INT);
-    // else do long comparisons
-    if (a->cell[0]->type == LVAL_FLOAT && a->cell[1] == LVAL_INT) {
-        a->cell[1] = lval_itof(a->cell[1]);
-    } else if (a->cell[0]->type == LVAL_INT && a->cell[1]->type == LVAL_FLOAT) {
-        a->cell[0] = lval_itof(a->cell[0]);
-    }
     lval* res;
     if (strcmp(op, "==") == 0) {
-        res = lval_int(lval_eq(a->cell[0], a->cell[1]));
+        res = lval_int(lval_eq_num(a->cell[0], a->cell[1]));
     } else {
-        res = lval_int(!lval_eq(a->cell[0], a->cell[1]));
+        res = lval_int(!lval_eq_num(a->cell[0], a->cell[1]));
     }
     lval_del(a);
     return res;
 }
 
+// (map-new pairs) builds a map from a list of {key value} pairs. an empty
+// map is made with (map-new {}), since (map-new) alone evaluates to the builtin
+lval* builtin_map_new(lenv* e, lval* a) {
+    LASSERT(a, a->count <= 1,
+            "Function 'map-new' passed incorrect number of arguments. "
+            "Got %i, Expected 0 or 1.", a->count);
+    lval* m = lval_map();
+    if (a->count == 0) {
+        lval_del(a);
+        return m;
+    }
+
+    LASSERT_TYPE("map-new", a, 0, LVAL_QEXPR);
+    lval* pairs = a->cell[0];
+    for (int i = 0; i < pairs->count; i++) {
+        lval* p = pairs->cell[i];
+        if (p->type != LVAL_QEXPR || p->count != 2) {
+            lval_del(m);
+            lval_del(a);
+            return lval_err("Function 'map-new' passed an item that is not a {key value} pair.");
+        }
+        lmap_put(m->map, lval_copy(p->cell[0]), lval_copy(p->cell[1]));
+    }
+    lval_del(a);
+    return m;
+}
+
+lval* builtin_map_get(lenv* e, lval* a) {
+    LASSERT(a, a->count == 2 || a->count == 3,
+            "Function 'map-get' passed incorrect number of arguments. "
+            "Got %i, Expected 2 or 3.", a->count);
+    LASSERT_TYPE("map-get", a, 0, LVAL_MAP);
+
+    lmap* m = a->cell[0]->map;
+    unsigned int h = lval_hash(a->cell[1]);
+    ltable_read(&m->lock);
+    int i = lmap_find(m, a->cell[1], h);
+    lval* x = i >= 0 ? lval_copy(m->entries[i].val) : NULL;
+    ltable_done(&m->lock);
+    if (x) {
+        lval_del(a);
+        return x;
+    }
+    // fall back to the default if one was given
+    LASSERT(a, a->count == 3, "Function 'map-get' key not found.");
+    return lval_take(a, 2);
+}
+
+lval* builtin_map_put(lenv* e, lval* a) {
+    LASSERT_NUM("map-put!", a, 3);
+    LASSERT_TYPE("map-put!", a, 0, LVAL_MAP);
+
+    lval* v = lval_pop(a, 2);
+    lval* k = lval_pop(a, 1);
+    lmap* m = a->cell[0]->map;
+    ltable_write(&m->lock);
+    lmap_put(m, k, v);
+    ltable_done(&m->lock);
+    return lval_take(a, 0);
+}
+
+lval* builtin_map_del(lenv* e, lval* a) {
+    LASSERT_NUM("map-del!", a, 2);
+    LASSERT_TYPE("map-del!", a, 0, LVAL_MAP);
+
+    lmap* m = a->cell[0]->map;
+    ltable_write(&m->lock);
+    lmap_del(m, a->cell[1]);
+    ltable_done(&m->lock);
+    return lval_take(a, 0);
+}
+
+lval* builtin_map_keys(lenv* e, lval* a) {
+    LASSERT_NUM("map-keys", a, 1);
+    LASSERT_TYPE("map-keys", a, 0, LVAL_MAP);
+
+    lmap* m = a->cell[0]->map;
+    lval* x = lval_qexpr();
+    ltable_read(&m->lock);
+    x->cell = malloc(sizeof(lval*) * (m->count ? m->count : 1));
+    for (int i = 0; i < m->cap; i++) {
+        lmap_entry* en = &m->entries[i];
+        if (lmap_live(en)) {
+            x->cell[x->count++] = lval_copy(en->key);
+        }
+    }
+    ltable_done(&m->lock);
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_map_len(lenv* e, lval* a) {
+    LASSERT_NUM("map-len", a, 1);
+    LASSERT_TYPE("map-len", a, 0, LVAL_MAP);
+
+    lmap* m = a->cell[0]->map;
+    ltable_read(&m->lock);
+    lval* x = lval_int(m->count);
+    ltable_done(&m->lock);
+    lval_del(a);
+    return x;
+}
+
+// (smap-new pairs) builds a sorted map from a list of {key value} pairs, and
+// (smap-new {}) an empty one
+lval* builtin_smap_new(lenv* e, lval* a) {
+    LASSERT(a, a->count <= 1,
+            "Function 'smap-new' passed incorrect number of arguments. "
+            "Got %i, Expected 0 or 1.", a->count);
+    lval* m = lval_sorted_map();
+    if (a->count == 0) {
+        lval_del(a);
+        return m;
+    }
+
+    LASSERT_TYPE("smap-new", a, 0, LVAL_QEXPR);
+    lval* pairs = a->cell[0];
+    for (int i = 0; i < pairs->count; i++) {
+        lval* p = pairs->cell[i];
+        if (p->type != LVAL_QEXPR || p->count != 2 || (p->cell[0]->type != LVAL_INT &&
+            p->cell[0]->type != LVAL_FLOAT && p->cell[0]->type != LVAL_STR)) {
+            lval_del(m);
+            lval_del(a);
+            return lval_err("Function 'smap-new' passed an item that is not a "
+                            "{key value} pair with an Int, Float or String key.");
+        }
+        lbtree_put(m->tree, lval_copy(p->cell[0]), lval_copy(p->cell[1]));
+    }
+    lval_del(a);
+    return m;
+}
+
+lval* builtin_smap_put(lenv* e, lval* a) {
+    LASSERT_NUM("smap-put!", a, 3);
+    LASSERT_TYPE("smap-put!", a, 0, LVAL_SORTED_MAP);
+    LASSERT_KEY("smap-put!", a, 1);
+
+    lval* v = lval_pop(a, 2);
+    lval* k = lval_pop(a, 1);
+    lbtree* t = a->cell[0]->tree;
+    ltable_write(&t->lock);
+    lbtree_put(t, k, v);
+    ltable_done(&t->lock);
+    return lval_take(a, 0);
+}
+
+lval* builtin_smap_get(lenv* e, lval* a) {
+    LASSERT(a, a->count == 2 || a->count == 3,
+            "Function 'smap-get' passed incorrect number of arguments. "
+            "Got %i, Expected 2 or 3.", a->count);
+    LASSERT_TYPE("smap-get", a, 0, LVAL_SORTED_MAP);
+    LASSERT_KEY("smap-get", a, 1);
+
+    lbtree* t = a->cell[0]->tree;
+    ltable_read(&t->lock);
+    lval* v = lbtree_get(t, a->cell[1]);
+    lval* x = v ? lval_copy(v) : NULL;
+    ltable_done(&t->lock);
+    if (x) {
+        lval_del(a);
+        return x;
+    }
+    LASSERT(a, a->count == 3, "Function 'smap-get' key not found.");
+    return lval_take(a, 2);
+}
+
+lval* builtin_smap_bound(lenv* e, lval* a, char* func, int ceil) {
+    LASSERT_NUM(func, a, 2);
+    LASSERT_TYPE(func, a, 0, LVAL_SORTED_MAP);
+    LASSERT_KEY(func, a, 1);
+
+    lbtree* t = a->cell[0]->tree;
+    ltable_read(&t->lock);
+    lval* x = lbtree_bound(t, a->cell[1], ceil);
+    ltable_done(&t->lock);
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_smap_floor(lenv* e, lval* a) {
+    return builtin_smap_bound(e, a, "smap-floor", 0);
+}
+
+lval* builtin_smap_ceil(lenv* e, lval* a) {
+    return builtin_smap_bound(e, a, "smap-ceil", 1);
+}
+
+// (range-scan m lo hi) gives the {key value} pairs with lo <= key < hi
+lval* builtin_range_scan(lenv* e, lval* a) {
+    LASSERT_NUM("range-scan", a, 3);
+    LASSERT_TYPE("range-scan", a, 0, LVAL_SORTED_MAP);
+    LASSERT_KEY("range-scan", a, 1);
+    LASSERT_KEY("range-scan", a, 2);
+
+    lbtree* t = a->cell[0]->tree;
+    lval* x = lval_qexpr();
+    ltable_read(&t->lock);
+    lbnode_scan(t->root, a->cell[1], a->cell[2], x);
+    ltable_done(&t->lock);
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_smap_keys(lenv* e, lval* a) {
+    LASSERT_NUM("smap-keys", a, 1);
+    LASSERT_TYPE("smap-keys", a, 0, LVAL_SORTED_MAP);
+
+    lbtree* t = a->cell[0]->tree;
+    lval* x = lval_qexpr();
+    ltable_read(&t->lock);
+    lbnode_scan(t->root, NULL, NULL, x);
+    ltable_done(&t->lock);
+    for (int i = 0; i < x->count; i++) {
+        x->cell[i] = lval_take(x->cell[i], 0);
+    }
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_smap_len(lenv* e, lval* a) {
+    LASSERT_NUM("smap-len", a, 1);
+    LASSERT_TYPE("smap-len", a, 0, LVAL_SORTED_MAP);
+
+    lbtree* t = a->cell[0]->tree;
+    ltable_read(&t->lock);
+    lval* x = lval_int(t->count);
+    ltable_done(&t->lock);
+    lval_del(a);
+    return x;
+}
+
 // TODO: cleaner way of doing these two
 lval* builtin_eq(lenv* e, lval* a) {
     return builtin_cmp(e, a, "==");
@@ -976,7 +2838,7 @@ lval* builtin_if(lenv* e, lval* a) {
     a->cell[1]->type = LVAL_SEXPR;
     a->cell[2]->type = LVAL_SEXPR;
 
-    if (a->cell[0]->integer) {
+    if (a->cell[0]->type == LVAL_INT ? a->cell[0]->integer : a->cell[0]->ffloat != 0) {
         result = lval_eval(e, lval_pop(a, 1));
     } else {
         result = lval_eval(e, lval_pop(a, 2));
@@ -1075,9 +2937,12 @@ lval* lval_call(lenv* e, lval* f, lval* a) {
 }
 
 lval* lval_join(lval* x, lval* y) {
-    // for each cell in y add it to x
-    while (y->count) {
-        x = lval_add(x, lval_pop(y, 0));
+    // move every cell in y onto the end of x in one go
+    if (y->count) {
+        x->cell = realloc(x->cell, sizeof(lval*) * (x->count + y->count));
+        memcpy(&x->cell[x->count], y->cell, sizeof(lval*) * y->count);
+        x->count += y->count;
+        y->count = 0;
     }
 
     // delete the empty y and return x
@@ -1087,43 +2952,118 @@ lval* lval_join(lval* x, lval* y) {
     return x;
 }
 
-lval* str_join(lval* a, lval* b) {
-    // join two strings
-    // +1 for null terminator
-    char* result = malloc(strlen(a->str) + strlen(b->str)+1);
-    strcpy(result, a->str);
-    strcat(result, b->str);
-    // clean up args
+// SUBSTRING SEARCH
+// candidate matches are found by comparing the first and last byte of the
+// needle against 16 (SSE2) or 32 (AVX2) haystack positions at once, and only
+// candidates are compared in full. AVX2 is chosen at startup when the cpu has
+// it, other targets fall back to memchr and memcmp
+
+// index of the first nn byte needle in the hn byte haystack, or -1
+int lstr_find_scalar(const char* h, int hn, const char* nd, int nn) {
+    if (hn < nn) { return -1; }
+    const char* p = h;
+    const char* last = h + hn - nn;
+    while (p <= last) {
+        p = memchr(p, nd[0], last - p + 1);
+        if (!p) { return -1; }
+        if (memcmp(p, nd, nn) == 0) { return (int) (p - h); }
+        p++;
+    }
+    return -1;
+}
+
+#ifdef LSTR_SIMD
+int lstr_find_sse2(const char* h, int hn, const char* nd, int nn) {
+    __m128i first = _mm_set1_epi8(nd[0]);
+    __m128i final = _mm_set1_epi8(nd[nn-1]);
+    int i = 0;
+    for (; i + nn - 1 + 16 <= hn; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (h + i));
+        __m128i b = _mm_loadu_si128((const __m128i*) (h + i + nn - 1));
+        unsigned int mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, final)));
+        while (mask) {
+            int j = i + __builtin_ctz(mask);
+            if (memcmp(h + j, nd, nn) == 0) { return j; }
+            mask &= mask - 1;
+        }
+    }
+    int r = lstr_find_scalar(h + i, hn - i, nd, nn);
+    return r < 0 ? -1 : i + r;
+}
+
+__attribute__((target("avx2")))
+int lstr_find_avx2(const char* h, int hn, const char* nd, int nn) {
+    __m256i first = _mm256_set1_epi8(nd[0]);
+    __m256i final = _mm256_set1_epi8(nd[nn-1]);
+    int i = 0;
+    for (; i + nn - 1 + 32 <= hn; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*) (h + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*) (h + i + nn - 1));
+        unsigned int mask = _mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, final)));
+        while (mask) {
+            int j = i + __builtin_ctz(mask);
+            if (memcmp(h + j, nd, nn) == 0) { return j; }
+            mask &= mask - 1;
+        }
+    }
+    int r = lstr_find_sse2(h + i, hn - i, nd, nn);
+    return r < 0 ? -1 : i + r;
+}
+#endif
+
+static int (*lstr_find_impl)(const char*, int, const char*, int) = lstr_find_scalar;
+
+// pick the widest string scanning the cpu supports, called once before any threads
+void lstr_simd_init(void) {
+#ifdef LSTR_SIMD
+    __builtin_cpu_init();
+    int avx2 = __builtin_cpu_supports("avx2");
+    lstr_find_impl = avx2 ? lstr_find_avx2 : lstr_find_sse2;
+    lstr_escape_scan = avx2 ? lstr_escape_scan_avx2 : lstr_escape_scan_sse2;
+#endif
+}
+
+// index of needle in s at or after from, or -1. the empty needle matches at from
+int lstr_find(lval* s, int from, lval* needle) {
+    if (needle->slen == 0) { return from; }
+    if (s->slen - from < needle->slen) { return -1; }
+    int r = lstr_find_impl(s->str + from, s->slen - from, needle->str, needle->slen);
+    return r < 0 ? -1 : from + r;
+}
+
+lval* str_join(lval* a) {
+    // size the result once then copy each string straight into place
+    size_t total = 0;
+    for (int i = 0; i < a->count; i++) { total += a->cell[i]->slen; }
+    char* result = malloc(total + 1);
+    char* p = result;
+    for (int i = 0; i < a->count; i++) {
+        memcpy(p, a->cell[i]->str, a->cell[i]->slen);
+        p += a->cell[i]->slen;
+    }
+    *p = '\0';
     lval_del(a);
-    lval_del(b);
-    return lval_str(result);
+    return lval_str_own(result, (int) total);
 }
 
 // TODO: adapt join, tail, head, to work on strings
 lval* builtin_join(lenv* e, lval* a) {
+    LASSERT(a, a->count > 0, "Function 'join' passed no arguments.");
     // if args are a string
     if (a->cell[0]->type == LVAL_STR) {
         for (int i = 0; i < a->count; i++) {
-            // TODO: maybe make this clearer?
-            LASSERT(a, a->cell[i]->type == LVAL_STR,
-                "Function 'join' passed incorrect type for arg %i ",
-                "Got %s, Expected %s.",
-                ltype_name(a->cell[i]->type), ltype_name(LVAL_STR));
-
-        }
-        // join first arg into x to kick it off
-        lval* x = lval_pop(a, 0);
-        while (a->count) {
-            x = str_join(x, lval_pop(a, 0));
+            LASSERT_TYPE("join", a, i, LVAL_STR);
         }
-        lval_del(a);
-        return x;
+        return str_join(a);
     } else {
         for (int i = 0; i < a->count; i++) {
-            LASSERT(a, a->cell[i]->type == LVAL_QEXPR,
-                "Function 'join' passed incorrect type for arg %i ",
-                "Got %s, Expected %s.",
-                ltype_name(a->cell[i]->type), ltype_name(LVAL_QEXPR));
+            // ranges have to be expanded to be joined
+            if (a->cell[i]->type == LVAL_RANGE) {
+                a->cell[i] = lval_range_realize(a->cell[i]);
+            }
+            LASSERT_TYPE("join", a, i, LVAL_QEXPR);
         }
 
         // TODO: go over the details of lval_pop and lval_take more
@@ -1138,21 +3078,1883 @@ lval* builtin_join(lenv* e, lval* a) {
     }
 }
 
-// TODO: build a more efficient cons
-lval* builtin_cons(lenv* e, lval* a) {
-    LASSERT(a, a->count == 2,
-            "Function 'cons' passed too many args. ",
-            "Got %i, Expected %i.",
-            a->count, 2);
-    lval* x = lval_qexpr();
-    x = lval_add(x, lval_pop(a, 0));
-    while (a->count) {
-        x = lval_join(x, lval_pop(a, 0));
+// append strings and numbers to a builder, amortised by the buffer doubling
+lval* builtin_sb_append(lenv* e, lval* a) {
+    LASSERT(a, a->count >= 1,
+            "Function 'sb-append!' passed incorrect number of arguments. "
+            "Got %i, Expected at least 1.", a->count);
+    LASSERT_TYPE("sb-append!", a, 0, LVAL_SBUILDER);
+    for (int i = 1; i < a->count; i++) {
+        LASSERT(a, (a->cell[i]->type == LVAL_STR || a->cell[i]->type == LVAL_INT ||
+                    a->cell[i]->type == LVAL_FLOAT),
+                "Function 'sb-append!' passed incorrect type for argument %i. "
+                "Got %s, Expected %s, %s or %s.", i, ltype_name(a->cell[i]->type),
+                ltype_name(LVAL_STR), ltype_name(LVAL_INT), ltype_name(LVAL_FLOAT));
+    }
+
+    lsbuilder* sb = a->cell[0]->sb;
+    lbuf* b = &sb->buf;
+    ltable_write(&sb->lock);
+    for (int i = 1; i < a->count; i++) {
+        lval* x = a->cell[i];
+        char num[64];
+        switch (x->type) {
+            case LVAL_STR: lbuf_write(b, x->str, x->slen); break;
+            case LVAL_INT: lbuf_write(b, num, lval_fmt_int(x->integer, num)); break;
+            case LVAL_FLOAT: lbuf_write(b, num, lval_fmt_float(x->ffloat, num)); break;
+        }
+    }
+    ltable_done(&sb->lock);
+    return lval_take(a, 0);
+}
+
+// (string-builder s) makes a new builder starting with s. (string-builder {})
+// makes an empty one, like the map constructors
+lval* builtin_string_builder(lenv* e, lval* a) {
+    LASSERT(a, a->count <= 1,
+            "Function 'string-builder' passed incorrect number of arguments. "
+            "Got %i, Expected 0 or 1.", a->count);
+    LASSERT(a, a->count == 0 || a->cell[0]->type == LVAL_STR ||
+            (a->cell[0]->type == LVAL_QEXPR && a->cell[0]->count == 0),
+            "Function 'string-builder' passed incorrect type for arg 0. "
+            "Got %s, Expected String or {}.", ltype_name(a->cell[0]->type));
+    lval* sb = lval_sbuilder();
+    if (a->count == 1 && a->cell[0]->type == LVAL_STR) {
+        lbuf_write(&sb->sb->buf, a->cell[0]->str, a->cell[0]->slen);
+    }
+    lval_del(a);
+    return sb;
+}
+
+lval* builtin_sb_to_string(lenv* e, lval* a) {
+    LASSERT_NUM("sb->string", a, 1);
+    LASSERT_TYPE("sb->string", a, 0, LVAL_SBUILDER);
+
+    lsbuilder* sb = a->cell[0]->sb;
+    ltable_read(&sb->lock);
+    lval* x = lval_str_n(sb->buf.data, (int) sb->buf.len);
+    ltable_done(&sb->lock);
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_sb_len(lenv* e, lval* a) {
+    LASSERT_NUM("sb-len", a, 1);
+    LASSERT_TYPE("sb-len", a, 0, LVAL_SBUILDER);
+
+    lsbuilder* sb = a->cell[0]->sb;
+    ltable_read(&sb->lock);
+    lval* x = lval_int((int) sb->buf.len);
+    ltable_done(&sb->lock);
+    lval_del(a);
+    return x;
+}
+
+// (substr s start n) the n characters of s from start, without copying
+lval* builtin_substr(lenv* e, lval* a) {
+    LASSERT_NUM("substr", a, 3);
+    LASSERT_TYPE("substr", a, 0, LVAL_STR);
+    LASSERT_TYPE("substr", a, 1, LVAL_INT);
+    LASSERT_TYPE("substr", a, 2, LVAL_INT);
+
+    int len = a->cell[0]->slen;
+    int from = a->cell[1]->integer;
+    int n = a->cell[2]->integer;
+    LASSERT(a, from >= 0 && n >= 0 && from <= len && n <= len - from,
+            "Function 'substr' passed bounds %i, %i outside a string of length %i.",
+            from, n, len);
+
+    lval* x = lval_str_slice(a->cell[0], from, n);
+    lval_del(a);
+    return x;
+}
+
+// (slice xs from [to]) the items of a string, list or range in [from, to)
+lval* builtin_slice(lenv* e, lval* a) {
+    LASSERT(a, a->count == 2 || a->count == 3,
+            "Function 'slice' passed incorrect number of arguments. "
+            "Got %i, Expected 2 or 3.", a->count);
+    LASSERT(a, (a->cell[0]->type == LVAL_STR || a->cell[0]->type == LVAL_QEXPR ||
+                a->cell[0]->type == LVAL_RANGE),
+            "Function 'slice' passed incorrect type for argument 0. "
+            "Got %s, Expected %s, %s or %s.", ltype_name(a->cell[0]->type),
+            ltype_name(LVAL_STR), ltype_name(LVAL_QEXPR), ltype_name(LVAL_RANGE));
+    for (int i = 1; i < a->count; i++) { LASSERT_TYPE("slice", a, i, LVAL_INT); }
+
+    int len = a->cell[0]->type == LVAL_STR ? a->cell[0]->slen : lval_seq_len(a->cell[0]);
+    int from = a->cell[1]->integer;
+    int to = a->count == 3 ? a->cell[2]->integer : len;
+    LASSERT(a, from >= 0 && from <= to && to <= len,
+            "Function 'slice' passed bounds %i, %i outside a sequence of length %i.",
+            from, to, len);
+
+    if (a->cell[0]->type == LVAL_STR) {
+        lval* x = lval_str_slice(a->cell[0], from, to - from);
+        lval_del(a);
+        return x;
+    }
+    return lval_seq_slice(lval_take(a, 0), from, to);
+}
+
+// (string-find s needle) index of the first needle in s, or -1
+lval* builtin_string_find(lenv* e, lval* a) {
+    LASSERT_NUM("string-find", a, 2);
+    LASSERT_TYPE("string-find", a, 0, LVAL_STR);
+    LASSERT_TYPE("string-find", a, 1, LVAL_STR);
+
+    lval* x = lval_int(lstr_find(a->cell[0], 0, a->cell[1]));
+    lval_del(a);
+    return x;
+}
+
+// (string-count s needle) number of non-overlapping needles in s
+lval* builtin_string_count(lenv* e, lval* a) {
+    LASSERT_NUM("string-count", a, 2);
+    LASSERT_TYPE("string-count", a, 0, LVAL_STR);
+    LASSERT_TYPE("string-count", a, 1, LVAL_STR);
+    LASSERT(a, a->cell[1]->slen > 0, "Function 'string-count' passed an empty needle.");
+
+    lval* s = a->cell[0];
+    lval* nd = a->cell[1];
+    int n = 0;
+    for (int i = lstr_find(s, 0, nd); i >= 0; i = lstr_find(s, i + nd->slen, nd)) { n++; }
+    lval_del(a);
+    return lval_int(n);
+}
+
+// (string-split s sep) list of the pieces of s between each sep, which
+// share the buffer of s where they are long enough
+lval* builtin_string_split(lenv* e, lval* a) {
+    LASSERT_NUM("string-split", a, 2);
+    LASSERT_TYPE("string-split", a, 0, LVAL_STR);
+    LASSERT_TYPE("string-split", a, 1, LVAL_STR);
+    LASSERT(a, a->cell[1]->slen > 0, "Function 'string-split' passed an empty separator.");
+
+    lval* s = a->cell[0];
+    lval* sep = a->cell[1];
+    lval* x = lval_qexpr();
+    int from = 0;
+    for (int i = lstr_find(s, 0, sep); i >= 0; i = lstr_find(s, from, sep)) {
+        lval_add(x, lval_str_slice(s, from, i - from));
+        from = i + sep->slen;
+    }
+    lval_add(x, lval_str_slice(s, from, s->slen - from));
+    lval_del(a);
+    return x;
+}
+
+// (string-replace s old new) s with every non-overlapping old replaced by new
+lval* builtin_string_replace(lenv* e, lval* a) {
+    LASSERT_NUM("string-replace", a, 3);
+    for (int i = 0; i < 3; i++) { LASSERT_TYPE("string-replace", a, i, LVAL_STR); }
+    LASSERT(a, a->cell[1]->slen > 0, "Function 'string-replace' passed an empty pattern.");
+
+    lval* s = a->cell[0];
+    lval* old = a->cell[1];
+    lval* new = a->cell[2];
+    int i = lstr_find(s, 0, old);
+    if (i < 0) { return lval_take(a, 0); }
+
+    // copy the clean runs between matches in bulk
+    lbuf b = { NULL, 0, 0 };
+    int from = 0;
+    for (; i >= 0; i = lstr_find(s, from, old)) {
+        lbuf_write(&b, s->str + from, i - from);
+        lbuf_write(&b, new->str, new->slen);
+        from = i + old->slen;
+    }
+    lbuf_write(&b, s->str + from, s->slen - from);
+    lbuf_write(&b, "", 1);
+    lval_del(a);
+    return lval_str_own(b.data, (int) b.len - 1);
+}
+
+// REGULAR EXPRESSIONS
+// patterns are compiled with mpc_re and kept in a small LRU cache keyed by
+// pattern text, so calling re-match in a loop compiles once. the literal text
+// every match has to start with is pulled out of the pattern and searched for
+// with lstr_find, so the mpc engine only runs at those candidate positions,
+// and patterns that are entirely literal never run it at all
+
+#define LREGEX_CACHE 32
+
+typedef struct {
+    int refs;
+    char* pat;
+    int len;
+    unsigned int hash;
+    unsigned long used;
+    mpc_parser_t* parser;
+    // literal prefix of every match, whole when it is the entire pattern
+    char* prefix;
+    int prefix_len;
+    int whole;
+    // pattern starts with ^ so can only match at the start
+    int anchored;
+} lregex;
+
+static lregex* lregex_cache[LREGEX_CACHE];
+static unsigned long lregex_clock = 0;
+static pthread_mutex_t lregex_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void lregex_release(lregex* re) {
+    if (__sync_sub_and_fetch(&re->refs, 1) != 0) { return; }
+    if (re->parser) { mpc_delete(re->parser); }
+    free(re->pat);
+    free(re->prefix);
+    free(re);
+}
+
+// unescape the literal text at the start of the pattern into out, stopping at
+// the first class, group or special character. returns its length
+int lregex_prefix(const char* p, char* out, int* whole) {
+    int n = 0;
+    *whole = 0;
+    // with an alternation a match can start with anything
+    if (strchr(p, '|')) { return 0; }
+    while (*p) {
+        char c = *p;
+        const char* next = p + 1;
+        if (c == '\\') {
+            // escaped punctuation is literal, \d \w and friends are classes
+            if (!p[1] || isalnum((unsigned char) p[1])) { return n; }
+            c = p[1];
+            next = p + 2;
+        } else if (strchr(".^$*+?()[]{}", c)) {
+            return n;
+        }
+        // a quantifier may make the character before it optional
+        if (*next && strchr("*+?{", *next)) { return n; }
+        out[n++] = c;
+        p = next;
+    }
+    *whole = 1;
+    return n;
+}
+
+// compile a pattern, or return an error
+lval* lregex_compile(lval* pat, lregex** out) {
+    char* src = lval_cstr(pat);
+    lregex* re = malloc(sizeof(lregex));
+    re->refs = 1;
+    re->len = pat->slen;
+    re->pat = malloc(pat->slen + 1);
+    memcpy(re->pat, src, pat->slen + 1);
+    re->hash = lval_str_hash(pat);
+    re->used = 0;
+    re->anchored = src[0] == '^';
+    re->prefix = malloc(pat->slen + 1);
+    re->prefix_len = lregex_prefix(src + re->anchored, re->prefix, &re->whole);
+    re->parser = NULL;
+
+    if (!re->whole) {
+        re->parser = mpc_re(src);
+        // mpc_re hands back a parser that always fails when the pattern is
+        // invalid, so run it once to find out
+        mpc_result_t r;
+        if (mpc_parse("<regex>", "", re->parser, &r)) {
+            free(r.output);
+        } else {
+            int bad = r.error->failure != NULL;
+            // mpc ends its messages with a newline
+            lval* err = bad ? lval_err("%.*s", (int) strcspn(r.error->failure, "\n"),
+                                       r.error->failure) : NULL;
+            mpc_err_delete(r.error);
+            if (bad) {
+                lregex_release(re);
+                return err;
+            }
+        }
+    }
+    *out = re;
+    return NULL;
+}
+
+// find a compiled pattern in the cache or compile and add it, evicting the
+// least recently used. the caller gets a reference of its own
+lval* lregex_get(lval* pat, lregex** out) {
+    unsigned int h = lval_str_hash(pat);
+    pthread_mutex_lock(&lregex_lock);
+    int slot = 0;
+    for (int i = 0; i < LREGEX_CACHE; i++) {
+        lregex* re = lregex_cache[i];
+        if (re && re->hash == h && re->len == pat->slen &&
+            memcmp(re->pat, pat->str, pat->slen) == 0) {
+            re->used = ++lregex_clock;
+            __sync_fetch_and_add(&re->refs, 1);
+            pthread_mutex_unlock(&lregex_lock);
+            *out = re;
+            return NULL;
+        }
+        if (!lregex_cache[slot]) { continue; }
+        if (!re || re->used < lregex_cache[slot]->used) { slot = i; }
+    }
+
+    lregex* re;
+    lval* err = lregex_compile(pat, &re);
+    if (!err) {
+        if (lregex_cache[slot]) { lregex_release(lregex_cache[slot]); }
+        re->used = ++lregex_clock;
+        re->refs++;
+        lregex_cache[slot] = re;
+        *out = re;
+    }
+    pthread_mutex_unlock(&lregex_lock);
+    return err;
+}
+
+// start of the first match in s at or after from, or -1. the match length is
+// put in *len. the mpc engine runs on in, which is reset at each candidate
+int lregex_search(lregex* re, lval* s, int from, int* len, mpc_input_t* in) {
+    const char* p = re->prefix;
+    int n = re->prefix_len;
+    int last = re->anchored ? 0 : s->slen;
+    for (int i = from; i <= last; i++) {
+        // skip ahead to the next place the literal prefix occurs
+        if (n) {
+            if (s->slen - i < n) { return -1; }
+            int k = lstr_find_impl(s->str + i, s->slen - i, p, n);
+            if (k < 0) { return -1; }
+            i += k;
+            if (i > last) { return -1; }
+        }
+        if (re->whole) {
+            *len = n;
+            return i;
+        }
+        mpc_result_t r;
+        mpc_input_reset_nstring(in, "<regex>", s->str + i, s->slen - i);
+        if (mpc_parse_input(in, re->parser, &r)) {
+            *len = (int) strlen(r.output);
+            free(r.output);
+            return i;
+        }
+        mpc_err_delete(r.error);
+    }
+    return -1;
+}
+
+// shared argument checking, leaves the compiled pattern in *re
+lval* lregex_args(char* func, lval* a, int count, lregex** re) {
+    LASSERT_NUM(func, a, count);
+    for (int i = 0; i < count; i++) { LASSERT_TYPE(func, a, i, LVAL_STR); }
+    lval* err = lregex_get(a->cell[0], re);
+    if (err) { lval_del(a); return err; }
+    return NULL;
+}
+
+// (re-match pat s) the first part of s matching pat, or {} when none does
+lval* builtin_re_match(lenv* e, lval* a) {
+    lregex* re;
+    lval* err = lregex_args("re-match", a, 2, &re);
+    if (err) { return err; }
+
+    mpc_input_t* in = mpc_input_new_nstring("<regex>", "", 0);
+    int len;
+    int i = lregex_search(re, a->cell[1], 0, &len, in);
+    lval* x = i < 0 ? lval_qexpr() : lval_str_slice(a->cell[1], i, len);
+    mpc_input_delete(in);
+    lregex_release(re);
+    lval_del(a);
+    return x;
+}
+
+// (re-find-all pat s) every non-overlapping match of pat in s
+lval* builtin_re_find_all(lenv* e, lval* a) {
+    lregex* re;
+    lval* err = lregex_args("re-find-all", a, 2, &re);
+    if (err) { return err; }
+
+    lval* s = a->cell[1];
+    lval* x = lval_qexpr();
+    mpc_input_t* in = mpc_input_new_nstring("<regex>", "", 0);
+    int len;
+    for (int i = 0; (i = lregex_search(re, s, i, &len, in)) >= 0; ) {
+        lval_add(x, lval_str_slice(s, i, len));
+        // step over empty matches so the search moves on
+        i += len ? len : 1;
+    }
+    mpc_input_delete(in);
+    lregex_release(re);
+    lval_del(a);
+    return x;
+}
+
+// (re-replace pat s r) s with every non-overlapping match of pat replaced by r
+lval* builtin_re_replace(lenv* e, lval* a) {
+    lregex* re;
+    lval* err = lregex_args("re-replace", a, 3, &re);
+    if (err) { return err; }
+
+    lval* s = a->cell[1];
+    lval* r = a->cell[2];
+    lbuf b = { NULL, 0, 0 };
+    mpc_input_t* in = mpc_input_new_nstring("<regex>", "", 0);
+    int from = 0;
+    int len;
+    for (int i = 0; (i = lregex_search(re, s, i, &len, in)) >= 0; ) {
+        lbuf_write(&b, s->str + from, i - from);
+        lbuf_write(&b, r->str, r->slen);
+        from = i + len;
+        if (len == 0) {
+            // keep the character an empty match stopped in front of
+            if (i < s->slen) { lbuf_write(&b, s->str + i, 1); }
+            from = i + 1;
+        }
+        i = from;
+    }
+    if (from < s->slen) { lbuf_write(&b, s->str + from, s->slen - from); }
+    lbuf_write(&b, "", 1);
+    mpc_input_delete(in);
+    lregex_release(re);
+    lval_del(a);
+    return lval_str_own(b.data, (int) b.len - 1);
+}
+
+// TODO: build a more efficient cons
+lval* builtin_cons(lenv* e, lval* a) {
+    LASSERT(a, a->count == 2,
+            "Function 'cons' passed too many args. ",
+            "Got %i, Expected %i.",
+            a->count, 2);
+    lval* x = lval_qexpr();
+    x = lval_add(x, lval_pop(a, 0));
+    while (a->count) {
+        x = lval_join(x, lval_pop(a, 0));
+    }
+    lval_del(a);
+    return x;
+}
+
+// call f with the arguments in a without copying f. used by the native list
+// functions to call the same function once per item. a is consumed
+lval* lval_apply(lenv* e, lval* f, lval* a) {
+    if (f->builtin) { return f->builtin(e, a); }
+
+    // partial application and variadic formals go through the full path
+    int simple = a->count == f->formals->count;
+    for (int i = 0; simple && i < f->formals->count; i++) {
+        if (strcmp(f->formals->cell[i]->sym, "&") == 0) { simple = 0; }
+    }
+    if (!simple) {
+        lval* fc = lval_copy(f);
+        lval* result = lval_call(e, fc, a);
+        lval_del(fc);
+        return result;
+    }
+
+    // bind the arguments in a fresh scope on top of the function env,
+    // moving the values across instead of copying them
+    lenv* scope = lenv_new();
+    scope->par = f->env;
+    f->env->par = e;
+    scope->count = a->count;
+    scope->syms = malloc(sizeof(char*) * a->count);
+    scope->vals = a->cell;
+    for (int i = 0; i < a->count; i++) {
+        scope->syms[i] = malloc(strlen(f->formals->cell[i]->sym) + 1);
+        strcpy(scope->syms[i], f->formals->cell[i]->sym);
+    }
+    a->count = 0;
+    a->cell = NULL;
+    lval_del(a);
+
+    lval* body = lval_copy(f->body);
+    body->type = LVAL_SEXPR;
+    lval* result = lval_eval(scope, body);
+    lenv_del(scope);
+    return result;
+}
+
+// call f with one or two arguments
+lval* lval_apply1(lenv* e, lval* f, lval* x) {
+    return lval_apply(e, f, lval_add(lval_sexpr(), x));
+}
+
+lval* lval_apply2(lenv* e, lval* f, lval* x, lval* y) {
+    return lval_apply(e, f, lval_add(lval_add(lval_sexpr(), x), y));
+}
+
+// read a predicate result as true (1) or false (0), consuming it. anything
+// that is not a number is returned through err and gives -1
+int lval_truth(char* func, lval* r, lval** err) {
+    if (r->type == LVAL_INT || r->type == LVAL_FLOAT) {
+        int t = r->type == LVAL_INT ? r->integer != 0 : r->ffloat != 0;
+        lval_del(r);
+        return t;
+    }
+    if (r->type == LVAL_ERR) {
+        *err = r;
+    } else {
+        *err = lval_err("Function '%s' predicate returned incorrect type. "
+                        "Got %s, Expected %s or %s.", func,
+                        ltype_name(r->type), ltype_name(LVAL_INT), ltype_name(LVAL_FLOAT));
+        lval_del(r);
+    }
+    return -1;
+}
+
+// LAZY SEQUENCES
+// a lazy sequence is a source (Q-Expression, range or lines of a file) plus
+// a pipeline of stages. adding a stage to a lazy sequence appends to its
+// pipeline, so (lazy-take 10 (lazy-filter f (lazy-map g l))) runs as one
+// pass over l pulling a single item at a time through every stage
+
+// wrap a sequence in a lazy sequence with an empty pipeline
+lval* lval_lazy(lval* source, int lines) {
+    lval* v = malloc(sizeof(lval));
+    v->type = LVAL_LAZY;
+    v->source = source;
+    v->lines = lines;
+    v->stage_count = 0;
+    v->stages = NULL;
+    return v;
+}
+
+// add a stage to the end of a sequence's pipeline, making it lazy if needed
+lval* lval_lazy_add(lval* v, int kind, lval* fn, int n) {
+    if (v->type != LVAL_LAZY) { v = lval_lazy(v, 0); }
+    v->stage_count++;
+    v->stages = realloc(v->stages, sizeof(lstage) * v->stage_count);
+    v->stages[v->stage_count-1].kind = kind;
+    v->stages[v->stage_count-1].fn = fn;
+    v->stages[v->stage_count-1].n = n;
+    return v;
+}
+
+// state for walking any sequence one item at a time
+typedef struct {
+    lval* seq;
+    int index;
+    int done;
+    int* taken;
+    FILE* file;
+    char* line;
+    size_t line_cap;
+} lval_iter;
+
+void lval_iter_init(lval_iter* it, lval* seq) {
+    it->seq = seq;
+    it->index = 0;
+    it->done = 0;
+    it->taken = NULL;
+    it->file = NULL;
+    it->line = NULL;
+    it->line_cap = 0;
+    if (seq->type == LVAL_LAZY) {
+        it->taken = calloc(seq->stage_count + 1, sizeof(int));
+        // a take of nothing should not pull anything from the source
+        for (int i = 0; i < seq->stage_count; i++) {
+            if (seq->stages[i].kind == LAZY_TAKE && seq->stages[i].n == 0) { it->done = 1; }
+        }
+    }
+}
+
+void lval_iter_end(lval_iter* it) {
+    if (it->file) { fclose(it->file); }
+    free(it->line);
+    free(it->taken);
+}
+
+// read the next line of a file without its line ending, NULL at the end.
+// the line is read into the iterator's buffer, which getline grows as needed
+lval* lval_read_line(lval_iter* it) {
+    ssize_t len = getline(&it->line, &it->line_cap, it->file);
+    if (len < 0) { return NULL; }
+    if (len && it->line[len-1] == '\n') { len--; }
+    if (len && it->line[len-1] == '\r') { len--; }
+    return lval_str_n(it->line, (int) len);
+}
+
+// next raw item from the source of a sequence, NULL when exhausted
+lval* lval_iter_source(lval_iter* it) {
+    lval* src = it->seq->type == LVAL_LAZY ? it->seq->source : it->seq;
+    if (it->seq->type == LVAL_LAZY && it->seq->lines) {
+        if (!it->file) {
+            it->file = fopen(lval_cstr(src), "r");
+            if (!it->file) {
+                it->done = 1;
+                return lval_err("Could not open file %s", src->str);
+            }
+        }
+        return lval_read_line(it);
+    }
+    if (it->index >= lval_seq_len(src)) { return NULL; }
+    return lval_seq_nth(src, it->index++);
+}
+
+// next item of a sequence after running it through every stage, NULL when
+// there are no more items. errors are returned once and end the iteration
+lval* lval_iter_next(lenv* e, lval_iter* it) {
+    while (!it->done) {
+        lval* x = lval_iter_source(it);
+        if (!x || x->type == LVAL_ERR) { it->done = 1; return x; }
+        if (it->seq->type != LVAL_LAZY) { return x; }
+
+        int i;
+        for (i = 0; i < it->seq->stage_count && x; i++) {
+            lstage* s = &it->seq->stages[i];
+            lval* err = NULL;
+            int keep;
+            switch (s->kind) {
+                case LAZY_MAP:
+                    x = lval_apply1(e, s->fn, x);
+                    if (x->type == LVAL_ERR) { it->done = 1; return x; }
+                break;
+                case LAZY_FILTER:
+                case LAZY_TAKE_WHILE:
+                    keep = lval_truth(s->kind == LAZY_FILTER ? "lazy-filter" : "take-while",
+                                      lval_apply1(e, s->fn, lval_copy(x)), &err);
+                    if (keep < 0) { lval_del(x); it->done = 1; return err; }
+                    if (!keep) {
+                        // a failed take-while ends the whole sequence
+                        if (s->kind == LAZY_TAKE_WHILE) { it->done = 1; }
+                        lval_del(x);
+                        x = NULL;
+                    }
+                break;
+                case LAZY_TAKE:
+                    if (it->taken[i] >= s->n) {
+                        it->done = 1;
+                        lval_del(x);
+                        x = NULL;
+                        break;
+                    }
+                    // nothing more can get past a full take, so stop early
+                    if (++it->taken[i] == s->n) { it->done = 1; }
+                break;
+            }
+        }
+        if (x) { return x; }
+    }
+    return NULL;
+}
+
+// fully evaluate a sequence into a Q-Expression
+lval* lval_realize(lenv* e, lval* seq) {
+    if (seq->type == LVAL_QEXPR) { return seq; }
+    if (seq->type == LVAL_RANGE) { return lval_range_realize(seq); }
+
+    lval* x = lval_qexpr();
+    lval_iter it;
+    lval_iter_init(&it, seq);
+    lval* y;
+    while ((y = lval_iter_next(e, &it))) {
+        if (y->type == LVAL_ERR) { lval_del(x); x = y; break; }
+        x = lval_add(x, y);
+    }
+    lval_iter_end(&it);
+    lval_del(seq);
+    return x;
+}
+
+// the first n items of a sequence as a Q-Expression, or fewer if it ends
+// first. only pulls as many items from a lazy sequence as it needs
+lval* lval_seq_take(lenv* e, lval* seq, int n) {
+    lval* x = lval_qexpr();
+    lval_iter it;
+    lval_iter_init(&it, seq);
+    lval* y;
+    while (x->count < n && (y = lval_iter_next(e, &it))) {
+        if (y->type == LVAL_ERR) { lval_del(x); x = y; break; }
+        x = lval_add(x, y);
+    }
+    lval_iter_end(&it);
+    return x;
+}
+
+// number of items in a sequence as an Int, or the error it produced
+lval* lval_seq_count(lenv* e, lval* seq) {
+    if (seq->type != LVAL_LAZY) { return lval_int(lval_seq_len(seq)); }
+    int n = 0;
+    lval* err = NULL;
+    lval_iter it;
+    lval_iter_init(&it, seq);
+    lval* y;
+    while ((y = lval_iter_next(e, &it))) {
+        if (y->type == LVAL_ERR) { err = y; break; }
+        lval_del(y);
+        n++;
+    }
+    lval_iter_end(&it);
+    return err ? err : lval_int(n);
+}
+
+// for builtins that need every item of a sequence at once, swaps a lazy
+// argument for its items. returns NULL, or the error the sequence produced
+// after freeing the arguments
+lval* lval_realize_arg(lenv* e, lval* a, int i) {
+    if (a->cell[i]->type != LVAL_LAZY) { return NULL; }
+    a->cell[i] = lval_realize(e, a->cell[i]);
+    if (a->cell[i]->type != LVAL_ERR) { return NULL; }
+    lval* err = lval_pop(a, i);
+    lval_del(a);
+    return err;
+}
+
+// shared by the stages that take a function
+lval* builtin_lazy_fn(lenv* e, lval* a, char* func, int kind) {
+    LASSERT_NUM(func, a, 2);
+    LASSERT_TYPE(func, a, 0, LVAL_FUN);
+    LASSERT_SEQ(func, a, 1);
+
+    lval* f = lval_pop(a, 0);
+    return lval_lazy_add(lval_take(a, 0), kind, f, 0);
+}
+
+lval* builtin_lazy_map(lenv* e, lval* a) {
+    return builtin_lazy_fn(e, a, "lazy-map", LAZY_MAP);
+}
+
+lval* builtin_lazy_filter(lenv* e, lval* a) {
+    return builtin_lazy_fn(e, a, "lazy-filter", LAZY_FILTER);
+}
+
+lval* builtin_take_while(lenv* e, lval* a) {
+    return builtin_lazy_fn(e, a, "take-while", LAZY_TAKE_WHILE);
+}
+
+lval* builtin_lazy_take(lenv* e, lval* a) {
+    LASSERT_NUM("lazy-take", a, 2);
+    LASSERT_TYPE("lazy-take", a, 0, LVAL_INT);
+    LASSERT_SEQ("lazy-take", a, 1);
+    int n = a->cell[0]->integer;
+    LASSERT(a, n >= 0, "Function 'lazy-take' passed negative count %i.", n);
+
+    return lval_lazy_add(lval_take(a, 1), LAZY_TAKE, NULL, n);
+}
+
+lval* builtin_lazy_lines(lenv* e, lval* a) {
+    LASSERT_NUM("lazy-lines", a, 1);
+    LASSERT_TYPE("lazy-lines", a, 0, LVAL_STR);
+    return lval_lazy(lval_take(a, 0), 1);
+}
+
+lval* builtin_realize(lenv* e, lval* a) {
+    LASSERT_NUM("realize", a, 1);
+    LASSERT_SEQ("realize", a, 0);
+    return lval_realize(e, lval_take(a, 0));
+}
+
+// PARALLEL MAP AND FOLD
+// pmap and pfold split a sequence into chunks and hand them to a fixed pool
+// of worker threads started on first use. each chunk gets its own copy of
+// the function, and the global environment is guarded by lenv_lock while
+// the workers are running
+
+typedef struct {
+    lval* f;
+    lval** items;
+    int count;
+    lenv* env;
+    int fold;
+    lval* result;
+} lchunk;
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static pthread_key_t pool_worker;
+static int pool_size = 0;
+static lchunk* pool_chunks = NULL;
+static int pool_count = 0;
+static int pool_next = 0;
+static int pool_pending = 0;
+
+// map f over a chunk in place, or fold it left starting from its first item
+void lchunk_run(lchunk* c) {
+    if (!c->fold) {
+        for (int i = 0; i < c->count; i++) {
+            c->items[i] = lval_apply1(c->env, c->f, c->items[i]);
+        }
+        return;
+    }
+    lval* acc = c->items[0];
+    for (int i = 1; i < c->count; i++) {
+        if (acc->type == LVAL_ERR) { lval_del(c->items[i]); continue; }
+        acc = lval_apply2(c->env, c->f, acc, c->items[i]);
+    }
+    c->result = acc;
+}
+
+void* pool_main(void* unused) {
+    pthread_setspecific(pool_worker, &pool_size);
+    pthread_mutex_lock(&pool_mutex);
+    while (1) {
+        while (pool_next >= pool_count) {
+            pthread_cond_wait(&pool_work, &pool_mutex);
+        }
+        lchunk* c = &pool_chunks[pool_next++];
+        pthread_mutex_unlock(&pool_mutex);
+
+        lchunk_run(c);
+
+        pthread_mutex_lock(&pool_mutex);
+        if (--pool_pending == 0) { pthread_cond_signal(&pool_done); }
+    }
+    return NULL;
+}
+
+// whether the calling thread is one of the workers
+int pool_in_worker(void) {
+    return pool_size && pthread_getspecific(pool_worker);
+}
+
+// fork-map only forks from outside the workers while no pmap is running, so
+// these locks are free then. taking them anyway means a child never starts
+// with one held, and the child gets none of the workers, so it starts its
+// own pool if it needs one
+void pool_fork_prepare(void) {
+    pthread_mutex_lock(&pool_mutex);
+    pthread_rwlock_wrlock(&lenv_lock);
+    pthread_mutex_lock(&lregex_lock);
+}
+
+void pool_fork_parent(void) {
+    pthread_mutex_unlock(&lregex_lock);
+    pthread_rwlock_unlock(&lenv_lock);
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+// the child's only thread has a new id, so its locks are made afresh
+// rather than unlocked
+void pool_fork_child(void) {
+    pthread_mutex_init(&lregex_lock, NULL);
+    pthread_rwlock_init(&lenv_lock, NULL);
+    pthread_mutex_init(&pool_mutex, NULL);
+    pthread_cond_init(&pool_work, NULL);
+    pthread_cond_init(&pool_done, NULL);
+    pool_size = 0;
+}
+
+// start the workers, returns the number running
+int pool_start(void) {
+    static int keyed = 0;
+    if (pool_size) { return pool_size; }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int n = cpus < 1 ? 1 : cpus > 64 ? 64 : (int) cpus;
+    if (!keyed) {
+        pthread_key_create(&pool_worker, NULL);
+        pthread_atfork(pool_fork_prepare, pool_fork_parent, pool_fork_child);
+        keyed = 1;
+    }
+    for (int i = 0; i < n; i++) {
+        pthread_t t;
+        if (pthread_create(&t, NULL, pool_main, NULL) != 0) { break; }
+        pthread_detach(t);
+        pool_size++;
+    }
+    return pool_size;
+}
+
+// run every chunk and wait for them all to finish. chunks run on the calling
+// thread when there are no workers or when called from inside a worker
+void pool_run(lchunk* chunks, int count) {
+    if (pool_in_worker() || pool_start() == 0 || count <= 1) {
+        for (int i = 0; i < count; i++) { lchunk_run(&chunks[i]); }
+        return;
+    }
+
+    pthread_mutex_lock(&pool_mutex);
+    lenv_shared++;
+    pool_chunks = chunks;
+    pool_count = count;
+    pool_next = 0;
+    pool_pending = count;
+    pthread_cond_broadcast(&pool_work);
+    while (pool_pending) {
+        pthread_cond_wait(&pool_done, &pool_mutex);
+    }
+    pool_chunks = NULL;
+    pool_count = 0;
+    pool_next = 0;
+    lenv_shared--;
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+// copy the items of a sequence into an array, realizing lazy sequences
+lval** lval_seq_items(lenv* e, lval* seq, int* count, lval** err) {
+    int size = seq->type == LVAL_LAZY ? 16 : lval_seq_len(seq);
+    lval** items = malloc(sizeof(lval*) * (size ? size : 1));
+    *count = 0;
+    *err = NULL;
+    lval_iter it;
+    lval_iter_init(&it, seq);
+    lval* x;
+    while ((x = lval_iter_next(e, &it))) {
+        if (x->type == LVAL_ERR) { *err = x; break; }
+        if (*count == size) { size *= 2; items = realloc(items, sizeof(lval*) * size); }
+        items[(*count)++] = x;
+    }
+    lval_iter_end(&it);
+    return items;
+}
+
+// split n items into chunks, one set per worker with some slack for balance
+lchunk* lchunk_split(lenv* e, lval* f, lval** items, int n, int fold, int* count) {
+    int workers = pool_in_worker() ? 1 : pool_start();
+    int chunks = workers < 1 ? 1 : workers * 4;
+    if (chunks > n) { chunks = n; }
+
+    lchunk* c = malloc(sizeof(lchunk) * chunks);
+    for (int i = 0; i < chunks; i++) {
+        int lo = (int) ((long long) n * i / chunks);
+        int hi = (int) ((long long) n * (i + 1) / chunks);
+        c[i].f = lval_copy(f);
+        c[i].items = items + lo;
+        c[i].count = hi - lo;
+        c[i].env = e;
+        c[i].fold = fold;
+        c[i].result = NULL;
+    }
+    *count = chunks;
+    return c;
+}
+
+lval* builtin_pmap(lenv* e, lval* a) {
+    LASSERT_NUM("pmap", a, 2);
+    LASSERT_TYPE("pmap", a, 0, LVAL_FUN);
+    LASSERT_SEQ("pmap", a, 1);
+
+    int n;
+    lval* err;
+    lval** items = lval_seq_items(e, a->cell[1], &n, &err);
+    if (err) {
+        for (int i = 0; i < n; i++) { lval_del(items[i]); }
+        free(items);
+        lval_del(a);
+        return err;
+    }
+
+    int count = 0;
+    lchunk* chunks = lchunk_split(e, a->cell[0], items, n, 0, &count);
+    pool_run(chunks, count);
+    for (int i = 0; i < count; i++) { lval_del(chunks[i].f); }
+    free(chunks);
+    lval_del(a);
+
+    // results are already in order, report the first error if any
+    lval* x = lval_qexpr();
+    x->count = n;
+    x->cell = items;
+    for (int i = 0; i < n; i++) {
+        if (items[i]->type == LVAL_ERR) { return lval_take(x, i); }
     }
-    lval_del(a);
     return x;
 }
 
+// f must be associative: each chunk is folded on its own and the chunk
+// results are then folded in order onto z
+lval* builtin_pfold(lenv* e, lval* a) {
+    LASSERT_NUM("pfold", a, 3);
+    LASSERT_TYPE("pfold", a, 0, LVAL_FUN);
+    LASSERT_SEQ("pfold", a, 2);
+
+    int n;
+    lval* err;
+    lval** items = lval_seq_items(e, a->cell[2], &n, &err);
+    if (err) {
+        for (int i = 0; i < n; i++) { lval_del(items[i]); }
+        free(items);
+        lval_del(a);
+        return err;
+    }
+
+    int count = 0;
+    lchunk* chunks = lchunk_split(e, a->cell[0], items, n, 1, &count);
+    pool_run(chunks, count);
+
+    lval* acc = lval_copy(a->cell[1]);
+    for (int i = 0; i < count; i++) {
+        if (acc->type == LVAL_ERR) {
+            lval_del(chunks[i].result);
+        } else if (chunks[i].result->type == LVAL_ERR) {
+            lval_del(acc);
+            acc = chunks[i].result;
+        } else {
+            acc = lval_apply2(e, a->cell[0], acc, chunks[i].result);
+        }
+        lval_del(chunks[i].f);
+    }
+    free(chunks);
+    free(items);
+    lval_del(a);
+    return acc;
+}
+
+// FORK MAP
+// fork-map runs slices of a list in child processes that inherit the loaded
+// environment copy-on-write. each child streams its results back over a
+// pipe in a compact binary form of lval, so nothing needs to be thread safe
+
+void lbuf_int(lbuf* b, int x) { lbuf_write(b, &x, sizeof(int)); }
+
+void lbuf_str(lbuf* b, char* s) {
+    int n = (int) strlen(s);
+    lbuf_int(b, n);
+    lbuf_write(b, s, n);
+}
+
+void lval_serialize(lbuf* b, lval* v);
+
+void lenv_serialize(lbuf* b, lenv* e) {
+    lbuf_int(b, e->count);
+    for (int i = 0; i < e->count; i++) {
+        lbuf_str(b, e->syms[i]);
+        lval_serialize(b, e->vals[i]);
+    }
+}
+
+// append v to b as a type byte followed by its contents
+void lval_serialize(lbuf* b, lval* v) {
+    char type = (char) v->type;
+    lbuf_write(b, &type, 1);
+    switch (v->type) {
+        case LVAL_INT: lbuf_int(b, v->integer); break;
+        case LVAL_FLOAT: lbuf_write(b, &v->ffloat, sizeof(float)); break;
+        case LVAL_ERR: lbuf_str(b, v->err); break;
+        case LVAL_SYM: lbuf_str(b, v->sym); break;
+        case LVAL_STR: lbuf_int(b, v->slen); lbuf_write(b, v->str, v->slen); break;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            lbuf_int(b, v->count);
+            for (int i = 0; i < v->count; i++) { lval_serialize(b, v->cell[i]); }
+        break;
+        case LVAL_FUN:
+            // forked children share the parent's code so builtins go as pointers
+            lbuf_write(b, &v->builtin, sizeof(lbuiltin));
+            if (!v->builtin) {
+                lenv_serialize(b, v->env);
+                lval_serialize(b, v->formals);
+                lval_serialize(b, v->body);
+            }
+        break;
+        case LVAL_RANGE:
+            lbuf_int(b, v->start);
+            lbuf_int(b, v->stop);
+            lbuf_int(b, v->step);
+        break;
+        case LVAL_LAZY:
+            lval_serialize(b, v->source);
+            lbuf_int(b, v->lines);
+            lbuf_int(b, v->stage_count);
+            for (int i = 0; i < v->stage_count; i++) {
+                lbuf_int(b, v->stages[i].kind);
+                lbuf_int(b, v->stages[i].n);
+                lbuf_int(b, v->stages[i].fn != NULL);
+                if (v->stages[i].fn) { lval_serialize(b, v->stages[i].fn); }
+            }
+        break;
+        case LVAL_MAP:
+            lbuf_int(b, v->map->count);
+            for (int i = 0; i < v->map->cap; i++) {
+                if (!lmap_live(&v->map->entries[i])) { continue; }
+                lval_serialize(b, v->map->entries[i].key);
+                lval_serialize(b, v->map->entries[i].val);
+            }
+        break;
+        case LVAL_SORTED_MAP: {
+            lval* pairs = lval_qexpr();
+            lbnode_scan(v->tree->root, NULL, NULL, pairs);
+            lval_serialize(b, pairs);
+            lval_del(pairs);
+        }
+        break;
+        case LVAL_SBUILDER:
+            lbuf_int(b, (int) v->sb->buf.len);
+            lbuf_write(b, v->sb->buf.data, v->sb->buf.len);
+        break;
+    }
+}
+
+// cursor over serialized data. ok is cleared if the data runs out early
+typedef struct {
+    const char* p;
+    const char* end;
+    int ok;
+} lreader;
+
+void lreader_read(lreader* r, void* out, size_t n) {
+    if (!r->ok || (size_t) (r->end - r->p) < n) {
+        r->ok = 0;
+        memset(out, 0, n);
+        return;
+    }
+    memcpy(out, r->p, n);
+    r->p += n;
+}
+
+int lreader_int(lreader* r) {
+    int x;
+    lreader_read(r, &x, sizeof(int));
+    return x;
+}
+
+// read a length prefixed string into a new NUL terminated buffer
+char* lreader_str(lreader* r) {
+    int n = lreader_int(r);
+    if (n < 0 || r->end - r->p < n) { r->ok = 0; n = 0; }
+    char* s = malloc(n + 1);
+    lreader_read(r, s, n);
+    s[n] = '\0';
+    return s;
+}
+
+lval* lval_deserialize(lreader* r);
+
+lenv* lenv_deserialize(lreader* r) {
+    lenv* e = lenv_new();
+    int n = lreader_int(r);
+    for (int i = 0; i < n && r->ok; i++) {
+        char* sym = lreader_str(r);
+        lval* k = lval_sym(sym);
+        lval* v = lval_deserialize(r);
+        lenv_put(e, k, v);
+        free(sym);
+        lval_del(k);
+        lval_del(v);
+    }
+    return e;
+}
+
+// rebuild an lval written by lval_serialize. malformed data gives an error
+lval* lval_deserialize(lreader* r) {
+    char type;
+    lreader_read(r, &type, 1);
+    if (!r->ok) { return lval_err("Truncated serialized value"); }
+
+    lval* v;
+    char* s;
+    switch (type) {
+        case LVAL_INT: return lval_int(lreader_int(r));
+        case LVAL_FLOAT: {
+            float f;
+            lreader_read(r, &f, sizeof(float));
+            return lval_float(f);
+        }
+        case LVAL_ERR:
+        case LVAL_SYM:
+        case LVAL_STR:
+            s = lreader_str(r);
+            v = type == LVAL_ERR ? lval_err("%s", s) :
+                type == LVAL_SYM ? lval_sym(s) : lval_str(s);
+            free(s);
+            return v;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR: {
+            v = type == LVAL_SEXPR ? lval_sexpr() : lval_qexpr();
+            int n = lreader_int(r);
+            for (int i = 0; i < n && r->ok; i++) {
+                v = lval_add(v, lval_deserialize(r));
+            }
+            return v;
+        }
+        case LVAL_FUN: {
+            lbuiltin builtin;
+            lreader_read(r, &builtin, sizeof(lbuiltin));
+            if (builtin) { return lval_fun(builtin); }
+            lenv* env = lenv_deserialize(r);
+            lval* formals = lval_deserialize(r);
+            lval* body = lval_deserialize(r);
+            v = lval_lambda(formals, body);
+            lenv_del(v->env);
+            v->env = env;
+            return v;
+        }
+        case LVAL_RANGE: {
+            int start = lreader_int(r);
+            int stop = lreader_int(r);
+            int step = lreader_int(r);
+            return lval_range(start, stop, step);
+        }
+        case LVAL_LAZY: {
+            lval* source = lval_deserialize(r);
+            v = lval_lazy(source, lreader_int(r));
+            int n = lreader_int(r);
+            for (int i = 0; i < n && r->ok; i++) {
+                int kind = lreader_int(r);
+                int count = lreader_int(r);
+                lval* fn = lreader_int(r) ? lval_deserialize(r) : NULL;
+                v = lval_lazy_add(v, kind, fn, count);
+            }
+            return v;
+        }
+        case LVAL_MAP: {
+            v = lval_map();
+            int n = lreader_int(r);
+            for (int i = 0; i < n && r->ok; i++) {
+                lval* k = lval_deserialize(r);
+                lmap_put(v->map, k, lval_deserialize(r));
+            }
+            return v;
+        }
+        case LVAL_SORTED_MAP: {
+            lval* pairs = lval_deserialize(r);
+            v = lval_sorted_map();
+            for (int i = 0; r->ok && pairs->type == LVAL_QEXPR && i < pairs->count; i++) {
+                lval* p = pairs->cell[i];
+                if (p->type != LVAL_QEXPR || p->count != 2) { r->ok = 0; break; }
+                lbtree_put(v->tree, lval_copy(p->cell[0]), lval_copy(p->cell[1]));
+            }
+            lval_del(pairs);
+            return v;
+        }
+        case LVAL_SBUILDER: {
+            v = lval_sbuilder();
+            int n = lreader_int(r);
+            if (n < 0 || r->end - r->p < n) { r->ok = 0; return v; }
+            lbuf_write(&v->sb->buf, r->p, n);
+            r->p += n;
+            return v;
+        }
+    }
+    r->ok = 0;
+    return lval_err("Unknown serialized type %i", type);
+}
+
+// write all of a buffer to a file descriptor
+int write_all(int fd, const char* p, size_t n) {
+    while (n) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0 && errno == EINTR) { continue; }
+        if (w <= 0) { return 0; }
+        p += w;
+        n -= w;
+    }
+    return 1;
+}
+
+// read a file descriptor until end of file into a buffer
+void read_all(int fd, lbuf* b) {
+    char chunk[65536];
+    ssize_t n;
+    while ((n = read(fd, chunk, sizeof(chunk))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) { continue; }
+            break;
+        }
+        lbuf_write(b, chunk, n);
+    }
+}
+
+lval* builtin_fork_map(lenv* e, lval* a) {
+    LASSERT_NUM("fork-map", a, 3);
+    LASSERT_TYPE("fork-map", a, 0, LVAL_INT);
+    LASSERT_TYPE("fork-map", a, 1, LVAL_FUN);
+    LASSERT_SEQ("fork-map", a, 2);
+    LASSERT(a, a->cell[0]->integer > 0,
+            "Function 'fork-map' needs at least 1 process. Got %i.", a->cell[0]->integer);
+    // the other workers may hold locks a forked child could never release
+    LASSERT(a, !pool_in_worker(), "Function 'fork-map' can't be called inside pmap or pfold.");
+
+    int n;
+    lval* err;
+    lval** items = lval_seq_items(e, a->cell[2], &n, &err);
+    if (err) {
+        for (int i = 0; i < n; i++) { lval_del(items[i]); }
+        free(items);
+        lval_del(a);
+        return err;
+    }
+
+    int procs = a->cell[0]->integer < n ? a->cell[0]->integer : n;
+    pid_t* pids = malloc(sizeof(pid_t) * (procs ? procs : 1));
+    int* fds = malloc(sizeof(int) * (procs ? procs : 1));
+
+    // anything still buffered would otherwise be printed by every child too
+    fflush(stdout);
+    fflush(stderr);
+
+    int started = 0;
+    for (; started < procs; started++) {
+        int lo = (int) ((long long) n * started / procs);
+        int hi = (int) ((long long) n * (started + 1) / procs);
+        int p[2];
+        if (pipe(p) != 0) { break; }
+        pid_t pid = fork();
+        if (pid < 0) {
+            close(p[0]);
+            close(p[1]);
+            break;
+        }
+        if (pid == 0) {
+            // child: map over this slice and send the results back
+            close(p[0]);
+            lval* x = lval_qexpr();
+            x->cell = malloc(sizeof(lval*) * (hi - lo));
+            for (int i = lo; i < hi; i++) {
+                x->cell[x->count++] = lval_apply1(e, a->cell[1], items[i]);
+            }
+            lbuf b = { NULL, 0, 0 };
+            lval_serialize(&b, x);
+            fflush(stdout);
+            _exit(write_all(p[1], b.data, b.len) ? 0 : 1);
+        }
+        close(p[1]);
+        pids[started] = pid;
+        fds[started] = p[0];
+    }
+
+    // collect each child's slice in order
+    lval* x = lval_qexpr();
+    lval* failed = NULL;
+    for (int i = 0; i < started; i++) {
+        lbuf b = { NULL, 0, 0 };
+        read_all(fds[i], &b);
+        close(fds[i]);
+        int status;
+        waitpid(pids[i], &status, 0);
+
+        lreader r = { b.data, b.data + b.len, 1 };
+        lval* slice = lval_deserialize(&r);
+        free(b.data);
+        if (!failed && (!r.ok || !WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+            failed = lval_err("Function 'fork-map' worker %i failed.", i);
+        }
+        if (failed || slice->type != LVAL_QEXPR) {
+            lval_del(slice);
+            continue;
+        }
+        x = lval_join(x, slice);
+    }
+    if (!failed && started < procs) {
+        failed = lval_err("Function 'fork-map' could not start worker %i.", started);
+    }
+
+    for (int i = 0; i < n; i++) { lval_del(items[i]); }
+    free(items);
+    free(pids);
+    free(fds);
+    lval_del(a);
+    if (failed) {
+        lval_del(x);
+        return failed;
+    }
+
+    // report the first error a worker hit
+    for (int i = 0; i < x->count; i++) {
+        if (x->cell[i]->type == LVAL_ERR) { return lval_take(x, i); }
+    }
+    return x;
+}
+
+// SORTING
+// sort orders by lval_cmp. lists of numbers go through an LSD radix sort,
+// anything else through introsort, or merge sort for the stable variants
+
+typedef struct {
+    lval* key;
+    lval* item;
+} lsort_entry;
+
+typedef struct {
+    uint64_t rank;
+    int index;
+} lsort_rank;
+
+// map a number to an unsigned rank with the same order
+uint64_t lsort_rank_of(lval* k, int all_int) {
+    if (all_int) { return (uint32_t) k->integer ^ 0x80000000u; }
+    double d = k->type == LVAL_INT ? (double) k->integer : k->ffloat;
+    if (d == 0) { d = 0; }
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    return bits >> 63 ? ~bits : bits | (1ull << 63);
+}
+
+// stable LSD radix sort on ranks, a byte at a time, skipping bytes that
+// are the same for every entry
+void lsort_radix(lsort_entry* v, int n, int all_int) {
+    lsort_rank* a = malloc(sizeof(lsort_rank) * n);
+    lsort_rank* b = malloc(sizeof(lsort_rank) * n);
+    for (int i = 0; i < n; i++) {
+        a[i].rank = lsort_rank_of(v[i].key, all_int);
+        a[i].index = i;
+    }
+
+    int bytes = all_int ? 4 : 8;
+    for (int shift = 0; shift < bytes * 8; shift += 8) {
+        int counts[257] = { 0 };
+        for (int i = 0; i < n; i++) { counts[((a[i].rank >> shift) & 0xff) + 1]++; }
+        if (counts[((a[0].rank >> shift) & 0xff) + 1] == n) { continue; }
+        for (int i = 0; i < 256; i++) { counts[i+1] += counts[i]; }
+        for (int i = 0; i < n; i++) { b[counts[(a[i].rank >> shift) & 0xff]++] = a[i]; }
+        lsort_rank* t = a; a = b; b = t;
+    }
+
+    lsort_entry* sorted = malloc(sizeof(lsort_entry) * n);
+    for (int i = 0; i < n; i++) { sorted[i] = v[a[i].index]; }
+    memcpy(v, sorted, sizeof(lsort_entry) * n);
+    free(sorted);
+    free(a);
+    free(b);
+}
+
+void lsort_insertion(lsort_entry* v, int lo, int hi) {
+    for (int i = lo + 1; i < hi; i++) {
+        lsort_entry x = v[i];
+        int j = i;
+        while (j > lo && lval_cmp(v[j-1].key, x.key) > 0) { v[j] = v[j-1]; j--; }
+        v[j] = x;
+    }
+}
+
+void lsort_sift(lsort_entry* v, int lo, int root, int n) {
+    lsort_entry x = v[lo + root];
+    while (2 * root + 1 < n) {
+        int child = 2 * root + 1;
+        if (child + 1 < n && lval_cmp(v[lo+child].key, v[lo+child+1].key) < 0) { child++; }
+        if (lval_cmp(x.key, v[lo+child].key) >= 0) { break; }
+        v[lo+root] = v[lo+child];
+        root = child;
+    }
+    v[lo+root] = x;
+}
+
+void lsort_heap(lsort_entry* v, int lo, int hi) {
+    int n = hi - lo;
+    for (int i = n / 2 - 1; i >= 0; i--) { lsort_sift(v, lo, i, n); }
+    for (int i = n - 1; i > 0; i--) {
+        lsort_entry t = v[lo]; v[lo] = v[lo+i]; v[lo+i] = t;
+        lsort_sift(v, lo, 0, i);
+    }
+}
+
+// quicksort with median of three pivots, falling back to heapsort when
+// the recursion gets too deep and insertion sort for short runs
+void lsort_intro(lsort_entry* v, int lo, int hi, int depth) {
+    while (hi - lo > 16) {
+        if (depth-- == 0) {
+            lsort_heap(v, lo, hi);
+            return;
+        }
+        int mid = lo + (hi - lo) / 2;
+        if (lval_cmp(v[mid].key, v[lo].key) < 0) { lsort_entry t = v[mid]; v[mid] = v[lo]; v[lo] = t; }
+        if (lval_cmp(v[hi-1].key, v[lo].key) < 0) { lsort_entry t = v[hi-1]; v[hi-1] = v[lo]; v[lo] = t; }
+        if (lval_cmp(v[hi-1].key, v[mid].key) < 0) { lsort_entry t = v[hi-1]; v[hi-1] = v[mid]; v[mid] = t; }
+        lval* pivot = v[mid].key;
+
+        // hoare partition around the pivot
+        int i = lo - 1, j = hi;
+        while (1) {
+            do { i++; } while (lval_cmp(v[i].key, pivot) < 0);
+            do { j--; } while (lval_cmp(v[j].key, pivot) > 0);
+            if (i >= j) { break; }
+            lsort_entry t = v[i]; v[i] = v[j]; v[j] = t;
+        }
+
+        // recurse into the smaller half and loop on the larger
+        if (j + 1 - lo < hi - j - 1) {
+            lsort_intro(v, lo, j + 1, depth);
+            lo = j + 1;
+        } else {
+            lsort_intro(v, j + 1, hi, depth);
+            hi = j + 1;
+        }
+    }
+    lsort_insertion(v, lo, hi);
+}
+
+// stable merge sort using tmp as scratch space
+void lsort_merge(lsort_entry* v, lsort_entry* tmp, int lo, int hi) {
+    if (hi - lo <= 16) {
+        lsort_insertion(v, lo, hi);
+        return;
+    }
+    int mid = lo + (hi - lo) / 2;
+    lsort_merge(v, tmp, lo, mid);
+    lsort_merge(v, tmp, mid, hi);
+    if (lval_cmp(v[mid-1].key, v[mid].key) <= 0) { return; }
+
+    memcpy(&tmp[lo], &v[lo], sizeof(lsort_entry) * (hi - lo));
+    int i = lo, j = mid, k = lo;
+    while (i < mid && j < hi) {
+        v[k++] = lval_cmp(tmp[j].key, tmp[i].key) < 0 ? tmp[j++] : tmp[i++];
+    }
+    while (i < mid) { v[k++] = tmp[i++]; }
+    while (j < hi) { v[k++] = tmp[j++]; }
+}
+
+// shared by sort, sort-by, stable-sort and stable-sort-by
+lval* builtin_sort_impl(lenv* e, lval* a, char* func, int by, int stable) {
+    LASSERT_NUM(func, a, (by ? 2 : 1));
+    if (by) { LASSERT_TYPE(func, a, 0, LVAL_FUN); }
+    LASSERT_SEQ(func, a, by ? 1 : 0);
+
+    int n;
+    lval* err;
+    lval** items = lval_seq_items(e, a->cell[by ? 1 : 0], &n, &err);
+    lsort_entry* v = malloc(sizeof(lsort_entry) * (n ? n : 1));
+    int keyed = 0;
+    int all_num = 1;
+    int all_int = 1;
+    for (; !err && keyed < n; keyed++) {
+        lval* k = by ? lval_apply1(e, a->cell[0], lval_copy(items[keyed])) : items[keyed];
+        if (k->type != LVAL_INT && k->type != LVAL_FLOAT && k->type != LVAL_STR) {
+            err = k->type == LVAL_ERR ? k : lval_err(
+                "Function '%s' cannot order %s. Expected %s, %s or %s.", func,
+                ltype_name(k->type), ltype_name(LVAL_INT), ltype_name(LVAL_FLOAT),
+                ltype_name(LVAL_STR));
+            if (by && err != k) { lval_del(k); }
+            if (!by && err == k) { items[keyed] = lval_sexpr(); }
+            break;
+        }
+        all_num &= k->type != LVAL_STR;
+        all_int &= k->type == LVAL_INT;
+        v[keyed].key = k;
+        v[keyed].item = items[keyed];
+    }
+    if (err) {
+        if (by) { for (int i = 0; i < keyed; i++) { lval_del(v[i].key); } }
+        for (int i = 0; i < n; i++) { lval_del(items[i]); }
+        free(items);
+        free(v);
+        lval_del(a);
+        return err;
+    }
+
+    if (n > 1 && all_num) {
+        lsort_radix(v, n, all_int);
+    } else if (n > 1 && stable) {
+        lsort_entry* tmp = malloc(sizeof(lsort_entry) * n);
+        lsort_merge(v, tmp, 0, n);
+        free(tmp);
+    } else if (n > 1) {
+        int depth = 0;
+        for (int m = n; m; m >>= 1) { depth += 2; }
+        lsort_intro(v, 0, n, depth);
+    }
+
+    lval* x = lval_qexpr();
+    x->count = n;
+    x->cell = items;
+    for (int i = 0; i < n; i++) {
+        if (by) { lval_del(v[i].key); }
+        x->cell[i] = v[i].item;
+    }
+    free(v);
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_sort(lenv* e, lval* a) {
+    return builtin_sort_impl(e, a, "sort", 0, 0);
+}
+
+lval* builtin_sort_by(lenv* e, lval* a) {
+    return builtin_sort_impl(e, a, "sort-by", 1, 0);
+}
+
+lval* builtin_stable_sort(lenv* e, lval* a) {
+    return builtin_sort_impl(e, a, "stable-sort", 0, 1);
+}
+
+lval* builtin_stable_sort_by(lenv* e, lval* a) {
+    return builtin_sort_impl(e, a, "stable-sort-by", 1, 1);
+}
+
+lval* builtin_map(lenv* e, lval* a) {
+    LASSERT_NUM("map", a, 2);
+    LASSERT_TYPE("map", a, 0, LVAL_FUN);
+    LASSERT_SEQ("map", a, 1);
+
+    lval* f = a->cell[0];
+    int size = a->cell[1]->type == LVAL_LAZY ? 16 : lval_seq_len(a->cell[1]);
+    lval* x = lval_qexpr();
+    x->cell = malloc(sizeof(lval*) * (size ? size : 1));
+    lval_iter it;
+    lval_iter_init(&it, a->cell[1]);
+    lval* y;
+    while ((y = lval_iter_next(e, &it))) {
+        if (y->type != LVAL_ERR) { y = lval_apply1(e, f, y); }
+        if (y->type == LVAL_ERR) { lval_del(x); x = y; break; }
+        if (x->count == size) { size *= 2; x->cell = realloc(x->cell, sizeof(lval*) * size); }
+        x->cell[x->count++] = y;
+    }
+    lval_iter_end(&it);
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_filter(lenv* e, lval* a) {
+    LASSERT_NUM("filter", a, 2);
+    LASSERT_TYPE("filter", a, 0, LVAL_FUN);
+    LASSERT_SEQ("filter", a, 1);
+
+    lval* f = a->cell[0];
+    int size = a->cell[1]->type == LVAL_LAZY ? 16 : lval_seq_len(a->cell[1]);
+    lval* x = lval_qexpr();
+    x->cell = malloc(sizeof(lval*) * (size ? size : 1));
+    lval_iter it;
+    lval_iter_init(&it, a->cell[1]);
+    lval* item;
+    while ((item = lval_iter_next(e, &it))) {
+        lval* err = item->type == LVAL_ERR ? item : NULL;
+        int keep = err ? -1 : lval_truth("filter", lval_apply1(e, f, lval_copy(item)), &err);
+        if (keep < 0) {
+            if (err != item) { lval_del(item); }
+            lval_del(x);
+            x = err;
+            break;
+        }
+        if (!keep) {
+            lval_del(item);
+            continue;
+        }
+        if (x->count == size) { size *= 2; x->cell = realloc(x->cell, sizeof(lval*) * size); }
+        x->cell[x->count++] = item;
+    }
+    lval_iter_end(&it);
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_foldl(lenv* e, lval* a) {
+    LASSERT_NUM("foldl", a, 3);
+    LASSERT_TYPE("foldl", a, 0, LVAL_FUN);
+    LASSERT_SEQ("foldl", a, 2);
+
+    lval* f = a->cell[0];
+    lval* acc = lval_copy(a->cell[1]);
+    lval_iter it;
+    lval_iter_init(&it, a->cell[2]);
+    lval* x;
+    while (acc->type != LVAL_ERR && (x = lval_iter_next(e, &it))) {
+        if (x->type == LVAL_ERR) { lval_del(acc); acc = x; break; }
+        acc = lval_apply2(e, f, acc, x);
+    }
+    lval_iter_end(&it);
+    lval_del(a);
+    return acc;
+}
+
+lval* builtin_foldr(lenv* e, lval* a) {
+    LASSERT_NUM("foldr", a, 3);
+    LASSERT_TYPE("foldr", a, 0, LVAL_FUN);
+    LASSERT_SEQ("foldr", a, 2);
+    lval* err = lval_realize_arg(e, a, 2);
+    if (err) { return err; }
+
+    lval* f = a->cell[0];
+    lval* l = a->cell[2];
+    lval* acc = lval_copy(a->cell[1]);
+    for (int i = lval_seq_len(l) - 1; i >= 0 && acc->type != LVAL_ERR; i--) {
+        acc = lval_apply2(e, f, lval_seq_nth(l, i), acc);
+    }
+    lval_del(a);
+    return acc;
+}
+
+lval* builtin_last(lenv* e, lval* a) {
+    LASSERT_NUM("last", a, 1);
+    LASSERT_SEQ("last", a, 0);
+    if (a->cell[0]->type == LVAL_LAZY) {
+        // keep only the latest item while running a lazy sequence
+        lval* x = NULL;
+        lval_iter it;
+        lval_iter_init(&it, a->cell[0]);
+        lval* y;
+        while ((y = lval_iter_next(e, &it))) {
+            if (x) { lval_del(x); }
+            x = y;
+            if (y->type == LVAL_ERR) { break; }
+        }
+        lval_iter_end(&it);
+        LASSERT(a, x, "Function 'last' passed {} for argument 0.");
+        lval_del(a);
+        return x;
+    }
+    int n = lval_seq_len(a->cell[0]);
+    LASSERT(a, n != 0, "Function 'last' passed {} for argument 0.");
+
+    lval* x = lval_seq_nth(a->cell[0], n - 1);
+    lval_del(a);
+    return x;
+}
+
+// shared by take, drop and init. keeps items [from, to) of the sequence
+lval* lval_seq_slice(lval* l, int from, int to) {
+    if (l->type == LVAL_RANGE) {
+        // slicing a range only moves its bounds
+        int len = lval_range_len(l);
+        int stop = to == len ? l->stop : lval_range_nth(l, to);
+        lval* x = lval_range(lval_range_nth(l, from), stop, l->step);
+        if (from == to) { x->start = x->stop; }
+        lval_del(l);
+        return x;
+    }
+    for (int i = 0; i < from; i++) { lval_del(l->cell[i]); }
+    for (int i = to; i < l->count; i++) { lval_del(l->cell[i]); }
+    memmove(l->cell, l->cell + from, sizeof(lval*) * (to - from));
+    l->count = to - from;
+    return l;
+}
+
+lval* builtin_take(lenv* e, lval* a) {
+    LASSERT_NUM("take", a, 2);
+    LASSERT_TYPE("take", a, 0, LVAL_INT);
+    LASSERT_SEQ("take", a, 1);
+    int n = a->cell[0]->integer;
+    LASSERT(a, n >= 0, "Function 'take' passed negative count %i.", n);
+    if (a->cell[1]->type == LVAL_LAZY) {
+        // only run a lazy sequence for as many items as are taken
+        lval* x = lval_seq_take(e, a->cell[1], n);
+        lval_del(a);
+        return x;
+    }
+
+    int len = lval_seq_len(a->cell[1]);
+    return lval_seq_slice(lval_take(a, 1), 0, n < len ? n : len);
+}
+
+lval* builtin_drop(lenv* e, lval* a) {
+    LASSERT_NUM("drop", a, 2);
+    LASSERT_TYPE("drop", a, 0, LVAL_INT);
+    LASSERT_SEQ("drop", a, 1);
+    lval* err = lval_realize_arg(e, a, 1);
+    if (err) { return err; }
+    int n = a->cell[0]->integer;
+    LASSERT(a, n >= 0, "Function 'drop' passed negative count %i.", n);
+
+    int len = lval_seq_len(a->cell[1]);
+    return lval_seq_slice(lval_take(a, 1), n < len ? n : len, len);
+}
+
+lval* builtin_init(lenv* e, lval* a) {
+    LASSERT_NUM("init", a, 1);
+    LASSERT_SEQ("init", a, 0);
+    lval* err = lval_realize_arg(e, a, 0);
+    if (err) { return err; }
+    int len = lval_seq_len(a->cell[0]);
+    LASSERT(a, len != 0, "Function 'init' passed {} for argument 0.");
+
+    return lval_seq_slice(lval_take(a, 0), 0, len - 1);
+}
+
+lval* builtin_reverse(lenv* e, lval* a) {
+    LASSERT_NUM("reverse", a, 1);
+    LASSERT_SEQ("reverse", a, 0);
+    lval* err = lval_realize_arg(e, a, 0);
+    if (err) { return err; }
+
+    lval* l = lval_take(a, 0);
+    if (l->type == LVAL_RANGE) {
+        int n = lval_range_len(l);
+        long long stop = (long long) l->start - l->step;
+        // step back from the last value, expanding if the bounds overflow
+        if (n == 0 || stop < INT_MIN || stop > INT_MAX || l->step == INT_MIN) {
+            l = lval_range_realize(l);
+        } else {
+            l->stop = (int) stop;
+            l->start = lval_range_nth(l, n - 1);
+            l->step = -l->step;
+            return l;
+        }
+    }
+    for (int i = 0, j = l->count - 1; i < j; i++, j--) {
+        lval* t = l->cell[i];
+        l->cell[i] = l->cell[j];
+        l->cell[j] = t;
+    }
+    return l;
+}
+
+lval* builtin_elem(lenv* e, lval* a) {
+    LASSERT_NUM("elem", a, 2);
+    LASSERT_SEQ("elem", a, 1);
+
+    lval* x = a->cell[0];
+    lval* l = a->cell[1];
+    int found = 0;
+    if (l->type == LVAL_RANGE) {
+        // a range can answer membership arithmetically
+        // only floats in int range can be cast to check they are whole
+        int whole = x->type == LVAL_FLOAT && x->ffloat >= -2147483648.0f &&
+                    x->ffloat < 2147483648.0f && x->ffloat == (int) x->ffloat;
+        if (x->type == LVAL_INT || whole) {
+            long long v = x->type == LVAL_INT ? x->integer : (int) x->ffloat;
+            long long off = v - l->start;
+            int n = lval_range_len(l);
+            found = n > 0 && off % l->step == 0 && off / l->step >= 0 && off / l->step < n;
+        }
+    } else if (l->type == LVAL_LAZY) {
+        // stop running a lazy sequence once x turns up
+        lval_iter it;
+        lval_iter_init(&it, l);
+        lval* y;
+        while (!found && (y = lval_iter_next(e, &it))) {
+            if (y->type == LVAL_ERR) {
+                lval_iter_end(&it);
+                lval_del(a);
+                return y;
+            }
+            found = lval_eq_num(x, y);
+            lval_del(y);
+        }
+        lval_iter_end(&it);
+    } else {
+        for (int i = 0; i < l->count && !found; i++) {
+            found = lval_eq_num(x, l->cell[i]);
+        }
+    }
+    lval_del(a);
+    return lval_int(found);
+}
+
+// sum or product of a sequence of numbers, staying an Int until a Float is seen
+lval* builtin_seq_op(lenv* e, lval* a, char* func, char op) {
+    LASSERT_NUM(func, a, 1);
+    LASSERT_SEQ(func, a, 0);
+
+    int iacc = op == '+' ? 0 : 1;
+    float facc = iacc;
+    int is_float = 0;
+    lval_iter it;
+    lval_iter_init(&it, a->cell[0]);
+    lval* x;
+    for (int i = 0; (x = lval_iter_next(e, &it)); i++) {
+        if (x->type != LVAL_INT && x->type != LVAL_FLOAT) {
+            lval* err = x->type == LVAL_ERR ? x : lval_err(
+                "Function '%s' passed incorrect type for item %i. "
+                "Got %s, Expected %s or %s.",
+                func, i, ltype_name(x->type), ltype_name(LVAL_INT), ltype_name(LVAL_FLOAT));
+            if (err != x) { lval_del(x); }
+            lval_iter_end(&it);
+            lval_del(a);
+            return err;
+        }
+        if (x->type == LVAL_FLOAT && !is_float) {
+            is_float = 1;
+            facc = iacc;
+        }
+        if (is_float) {
+            float y = x->type == LVAL_FLOAT ? x->ffloat : x->integer;
+            facc = op == '+' ? facc + y : facc * y;
+        } else {
+            int overflow = op == '+' ? __builtin_add_overflow(iacc, x->integer, &iacc)
+                                     : __builtin_mul_overflow(iacc, x->integer, &iacc);
+            if (overflow) {
+                lval_del(x);
+                lval_iter_end(&it);
+                lval_del(a);
+                return lval_err("Function '%s' overflowed an Int at item %i.", func, i);
+            }
+        }
+        lval_del(x);
+    }
+    lval_iter_end(&it);
+    lval_del(a);
+    return is_float ? lval_float(facc) : lval_int(iacc);
+}
+
+lval* builtin_sum(lenv* e, lval* a) {
+    return builtin_seq_op(e, a, "sum", '+');
+}
+
+lval* builtin_product(lenv* e, lval* a) {
+    return builtin_seq_op(e, a, "product", '*');
+}
+
 lval* builtin_lambda(lenv* e, lval* a) {
     // check two arguments, each of which are q expressions
     LASSERT_NUM("fn", a, 2);
@@ -1270,7 +5072,7 @@ lval* builtin_error(lenv* e, lval* a) {
     LASSERT_TYPE("error", a, 0, LVAL_STR);
 
     // construct error from first argument
-    lval* err = lval_err(a->cell[0]->str);
+    lval* err = lval_err(lval_cstr(a->cell[0]));
 
     // delete arguments and return
     lval_del(a);
@@ -1285,9 +5087,9 @@ lval* builtin_import(lenv* e, lval* a) {
 
     // the path to all system slither libraries
     char* syslib_path = "/usr/local/lib/slither/";
-    char* import_file = malloc(strlen(syslib_path) + strlen(a->cell[0]->str)+5); // + 5 for .slr and null term
+    char* import_file = malloc(strlen(syslib_path) + a->cell[0]->slen + 5); // + 5 for .slr and null term
     strcpy(import_file, syslib_path);
-    strcat(import_file, a->cell[0]->str);
+    strcat(import_file, lval_cstr(a->cell[0]));
     strcat(import_file, ".slr");
     lval* file = lval_add(lval_sexpr(), lval_str(import_file));
     lval_del(a);
@@ -1313,6 +5115,55 @@ void lenv_add_builtins(lenv* e) {
     lenv_add_builtin(e, "join", builtin_join);
     lenv_add_builtin(e, "cons", builtin_cons);
     lenv_add_builtin(e, "len", builtin_len);
+    lenv_add_builtin(e, "range", builtin_range);
+    lenv_add_builtin(e, "nth", builtin_nth);
+    lenv_add_builtin(e, "last", builtin_last);
+    lenv_add_builtin(e, "take", builtin_take);
+    lenv_add_builtin(e, "drop", builtin_drop);
+    lenv_add_builtin(e, "init", builtin_init);
+    lenv_add_builtin(e, "reverse", builtin_reverse);
+    lenv_add_builtin(e, "elem", builtin_elem);
+    lenv_add_builtin(e, "map", builtin_map);
+    lenv_add_builtin(e, "filter", builtin_filter);
+    lenv_add_builtin(e, "foldl", builtin_foldl);
+    lenv_add_builtin(e, "foldr", builtin_foldr);
+    lenv_add_builtin(e, "sum", builtin_sum);
+    lenv_add_builtin(e, "product", builtin_product);
+    lenv_add_builtin(e, "sort", builtin_sort);
+    lenv_add_builtin(e, "sort-by", builtin_sort_by);
+    lenv_add_builtin(e, "stable-sort", builtin_stable_sort);
+    lenv_add_builtin(e, "stable-sort-by", builtin_stable_sort_by);
+
+    // lazy sequence functions
+    lenv_add_builtin(e, "lazy-map", builtin_lazy_map);
+    lenv_add_builtin(e, "lazy-filter", builtin_lazy_filter);
+    lenv_add_builtin(e, "take-while", builtin_take_while);
+    lenv_add_builtin(e, "lazy-take", builtin_lazy_take);
+    lenv_add_builtin(e, "lazy-lines", builtin_lazy_lines);
+    lenv_add_builtin(e, "realize", builtin_realize);
+
+    // parallel functions
+    lenv_add_builtin(e, "pmap", builtin_pmap);
+    lenv_add_builtin(e, "pfold", builtin_pfold);
+    lenv_add_builtin(e, "fork-map", builtin_fork_map);
+
+    // hash map functions
+    lenv_add_builtin(e, "map-new", builtin_map_new);
+    lenv_add_builtin(e, "map-get", builtin_map_get);
+    lenv_add_builtin(e, "map-put!", builtin_map_put);
+    lenv_add_builtin(e, "map-del!", builtin_map_del);
+    lenv_add_builtin(e, "map-keys", builtin_map_keys);
+    lenv_add_builtin(e, "map-len", builtin_map_len);
+
+    // sorted map functions
+    lenv_add_builtin(e, "smap-new", builtin_smap_new);
+    lenv_add_builtin(e, "smap-put!", builtin_smap_put);
+    lenv_add_builtin(e, "smap-get", builtin_smap_get);
+    lenv_add_builtin(e, "smap-floor", builtin_smap_floor);
+    lenv_add_builtin(e, "smap-ceil", builtin_smap_ceil);
+    lenv_add_builtin(e, "smap-keys", builtin_smap_keys);
+    lenv_add_builtin(e, "smap-len", builtin_smap_len);
+    lenv_add_builtin(e, "range-scan", builtin_range_scan);
 
     // mathematical functions
     lenv_add_builtin(e, "+", builtin_add);
@@ -1348,6 +5199,19 @@ void lenv_add_builtins(lenv* e) {
     lenv_add_builtin(e, "error", builtin_error);
     lenv_add_builtin(e, "print", builtin_print);
     lenv_add_builtin(e, "show", builtin_show);
+    lenv_add_builtin(e, "string-builder", builtin_string_builder);
+    lenv_add_builtin(e, "sb-append!", builtin_sb_append);
+    lenv_add_builtin(e, "sb->string", builtin_sb_to_string);
+    lenv_add_builtin(e, "sb-len", builtin_sb_len);
+    lenv_add_builtin(e, "substr", builtin_substr);
+    lenv_add_builtin(e, "slice", builtin_slice);
+    lenv_add_builtin(e, "string-find", builtin_string_find);
+    lenv_add_builtin(e, "string-count", builtin_string_count);
+    lenv_add_builtin(e, "string-split", builtin_string_split);
+    lenv_add_builtin(e, "string-replace", builtin_string_replace);
+    lenv_add_builtin(e, "re-match", builtin_re_match);
+    lenv_add_builtin(e, "re-find-all", builtin_re_find_all);
+    lenv_add_builtin(e, "re-replace", builtin_re_replace);
 }
 
 // TODO: do i still need this function?
@@ -1427,7 +5291,7 @@ int main(int argc, char** argv) {
     Slither = mpc_new("slither");
 
     // define them with the following language
-    mpca_lang(MPCA_LANG_DEFAULT,
+    mpca_lang(MPCA_LANG_ARENA,
             "                                                                                  \
             float    : /-?[0-9]+\\.?[0-9]+/ ;                                                  \
             int      : /-?[0-9]+/ ;                                                            \
@@ -1444,6 +5308,8 @@ int main(int argc, char** argv) {
     // create environment
     lenv* e = lenv_new();
     lenv_add_builtins(e);
+    lstr_simd_init();
+    lsrc_init();
 
     // load std lib no matter prompt or file loaded
     // NOTE this filepath is relative to the slither binary
@@ -1463,22 +5329,21 @@ int main(int argc, char** argv) {
 
             // output our prompt and get input
             char* input = readline("slither> ");
+            if (!input) { break; }
 
-            mpc_result_t r;
             // add input to our history
             add_history(input);
 
-            if (mpc_parse("<stdin>", input, Slither, &r)) {
+            lval* expr = lval_read_text("<stdin>", input, (int) strlen(input));
+            if (expr->type != LVAL_ERR) {
                 // on success print the evaluation
-                lval* x = lval_eval(e, lval_read(r.output));
+                lval* x = lval_eval(e, expr);
                 lval_println(x);
                 lval_del(x);
-
-                mpc_ast_delete(r.output);
             } else {
                 // otherwise print the error
-                mpc_err_print(r.error);
-                mpc_err_delete(r.error);
+                puts(expr->err);
+                lval_del(expr);
             }
 
         // free retrieved input
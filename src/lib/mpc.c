@@ -1,5 +1,13 @@
 #include "mpc.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define MPC_USE_MMAP
+#endif
+
 /*
 ** State Type
 */
@@ -73,14 +81,20 @@ typedef struct {
   char mem[64];
 } mpc_mem_t;
 
-typedef struct {
+typedef struct mpc_memo_t mpc_memo_t;
+typedef struct mpc_arena_t mpc_arena_t;
+
+struct mpc_input_t {
 
   int type;
   char *filename;  
   mpc_state_t state;
   
-  char *string;
+  const char *string;
+  long length;
   char *buffer;
+  long buffer_len;
+  long buffer_cap;
   FILE *file;
   
   int suppress;
@@ -96,37 +110,74 @@ typedef struct {
   char mem_full[MPC_INPUT_MEM_NUM];
   mpc_mem_t mem[MPC_INPUT_MEM_NUM];
   
-} mpc_input_t;
+  mpc_memo_t *memo;
+  long memo_nodes;
+  
+  int strs_num;
+  char **strs;
+  
+  mpc_arena_t *arena;
+  
+};
 
-static mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
+static void mpc_memo_clear(mpc_input_t *i);
 
-  mpc_input_t *i = malloc(sizeof(mpc_input_t));
+/*
+** String inputs borrow the caller's buffer rather than copying it, and know
+** its length so the end of input check is a comparison. A string input can
+** be reset onto a new buffer and reused, keeping its marks and memory pool.
+*/
+
+void mpc_input_reset_nstring(mpc_input_t *i, const char *filename, const char *string, long length) {
   
-  i->filename = malloc(strlen(filename) + 1);
-  strcpy(i->filename, filename);
+  if (i->filename == NULL || strcmp(i->filename, filename) != 0) {
+    free(i->filename);
+    i->filename = malloc(strlen(filename) + 1);
+    strcpy(i->filename, filename);
+  }
   i->type = MPC_INPUT_STRING;
   
   i->state = mpc_state_new();
   
-  i->string = malloc(strlen(string) + 1);
-  strcpy(i->string, string);
+  i->string = string;
+  i->length = length;
   i->buffer = NULL;
+  i->buffer_len = 0;
+  i->buffer_cap = 0;
   i->file = NULL;
   
   i->suppress = 0;
   i->backtrack = 1;
   i->marks_num = 0;
-  i->marks_slots = MPC_INPUT_MARKS_MIN;
-  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
-  i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
   
   i->mem_index = 0;
   memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
   
+  mpc_memo_clear(i);
+}
+
+mpc_input_t *mpc_input_new_nstring(const char *filename, const char *string, long length) {
+
+  mpc_input_t *i = malloc(sizeof(mpc_input_t));
+  
+  i->filename = NULL;
+  i->marks_slots = MPC_INPUT_MARKS_MIN;
+  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
+  i->lasts = malloc(sizeof(char) * i->marks_slots);
+  i->memo = NULL;
+  i->strs_num = 0;
+  i->strs = NULL;
+  i->arena = NULL;
+  
+  mpc_input_reset_nstring(i, filename, string, length);
   return i;
 }
 
+static mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
+  return mpc_input_new_nstring(filename, string, (long)strlen(string));
+}
+
 static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
 
   mpc_input_t *i = malloc(sizeof(mpc_input_t));
@@ -139,6 +190,8 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   
   i->string = NULL;
   i->buffer = NULL;
+  i->buffer_len = 0;
+  i->buffer_cap = 0;
   i->file = pipe;
   
   i->suppress = 0;
@@ -152,6 +205,13 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->mem_index = 0;
   memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
   
+  i->memo = NULL;
+  i->memo_nodes = 0;
+  
+  i->strs_num = 0;
+  i->strs = NULL;
+  i->arena = NULL;
+  
   return i;
   
 }
@@ -167,6 +227,8 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   
   i->string = NULL;
   i->buffer = NULL;
+  i->buffer_len = 0;
+  i->buffer_cap = 0;
   i->file = file;
   
   i->suppress = 0;
@@ -180,18 +242,29 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->mem_index = 0;
   memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
   
+  i->memo = NULL;
+  i->memo_nodes = 0;
+  
+  i->strs_num = 0;
+  i->strs = NULL;
+  i->arena = NULL;
+  
   return i;
 }
 
-static void mpc_input_delete(mpc_input_t *i) {
+void mpc_input_delete(mpc_input_t *i) {
+  
+  int j;
   
   free(i->filename);
   
-  if (i->type == MPC_INPUT_STRING) { free(i->string); }
   if (i->type == MPC_INPUT_PIPE) { free(i->buffer); }
   
   free(i->marks);
   free(i->lasts);
+  mpc_memo_clear(i);
+  for (j = 0; j < i->strs_num; j++) { free(i->strs[j]); }
+  free(i->strs);
   free(i);
 }
 
@@ -281,7 +354,9 @@ static void mpc_input_mark(mpc_input_t *i) {
   i->lasts[i->marks_num-1] = i->last;
   
   if (i->type == MPC_INPUT_PIPE && i->marks_num == 1) {
-    i->buffer = calloc(1, 1);
+    i->buffer_len = 0;
+    i->buffer_cap = 64;
+    i->buffer = malloc(i->buffer_cap);
   }
   
 }
@@ -323,7 +398,7 @@ static void mpc_input_rewind(mpc_input_t *i) {
 }
 
 static int mpc_input_buffer_in_range(mpc_input_t *i) {
-  return i->state.pos < (long)(strlen(i->buffer) + i->marks[0].pos);
+  return i->state.pos < i->buffer_len + i->marks[0].pos;
 }
 
 static char mpc_input_buffer_get(mpc_input_t *i) {
@@ -331,7 +406,7 @@ static char mpc_input_buffer_get(mpc_input_t *i) {
 }
 
 static int mpc_input_terminated(mpc_input_t *i) {
-  if (i->type == MPC_INPUT_STRING && i->state.pos == (long)strlen(i->string)) { return 1; }
+  if (i->type == MPC_INPUT_STRING && i->state.pos >= i->length) { return 1; }
   if (i->type == MPC_INPUT_FILE && feof(i->file)) { return 1; }
   if (i->type == MPC_INPUT_PIPE && feof(i->file)) { return 1; }
   return 0;
@@ -343,7 +418,7 @@ static char mpc_input_getc(mpc_input_t *i) {
   
   switch (i->type) {
     
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING: return i->state.pos < i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_FILE: c = fgetc(i->file); return c;
     case MPC_INPUT_PIPE:
     
@@ -366,7 +441,7 @@ static char mpc_input_peekc(mpc_input_t *i) {
   char c = '\0';
   
   switch (i->type) {
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING: return i->state.pos < i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_FILE: 
       
       c = fgetc(i->file);
@@ -422,9 +497,11 @@ static int mpc_input_success(mpc_input_t *i, char c, char **o) {
   
   if (i->type == MPC_INPUT_PIPE
   &&  i->buffer && !mpc_input_buffer_in_range(i)) {
-    i->buffer = realloc(i->buffer, strlen(i->buffer) + 2);
-    i->buffer[strlen(i->buffer) + 1] = '\0';
-    i->buffer[strlen(i->buffer) + 0] = c;
+    if (i->buffer_len == i->buffer_cap) {
+      i->buffer_cap *= 2;
+      i->buffer = realloc(i->buffer, i->buffer_cap);
+    }
+    i->buffer[i->buffer_len++] = c;
   }
   
   i->last = c;
@@ -606,17 +683,23 @@ char *mpc_err_string(mpc_err_t *x) {
   return realloc(buffer, strlen(buffer) + 1);
 }
 
+/*
+** While parsing, errors borrow their strings from the
+** parsers and the input rather than copying them, and
+** are merged in place. Most are thrown away once some
+** later alternative succeeds, so nothing is copied out
+** until `mpc_err_export` when the whole parse fails.
+*/
+
 static mpc_err_t *mpc_err_new(mpc_input_t *i, const char *expected) {
   mpc_err_t *x;
   if (i->suppress) { return NULL; }
   x = mpc_malloc(i, sizeof(mpc_err_t));
-  x->filename = mpc_malloc(i, strlen(i->filename) + 1);
-  strcpy(x->filename, i->filename);
+  x->filename = i->filename;
   x->state = i->state;
   x->expected_num = 1;
   x->expected = mpc_malloc(i, sizeof(char*));
-  x->expected[0] = mpc_malloc(i, strlen(expected) + 1);
-  strcpy(x->expected[0], expected);
+  x->expected[0] = (char*)expected;
   x->failure = NULL;
   x->recieved = mpc_input_peekc(i);
   return x;
@@ -626,13 +709,11 @@ static mpc_err_t *mpc_err_fail(mpc_input_t *i, const char *failure) {
   mpc_err_t *x;
   if (i->suppress) { return NULL; }
   x = mpc_malloc(i, sizeof(mpc_err_t));
-  x->filename = mpc_malloc(i, strlen(i->filename) + 1);
-  strcpy(x->filename, i->filename);
+  x->filename = i->filename;
   x->state = i->state;
   x->expected_num = 0;
   x->expected = NULL;
-  x->failure = mpc_malloc(i, strlen(failure) + 1);
-  strcpy(x->failure, failure);
+  x->failure = (char*)failure;
   x->recieved = ' ';
   return x;
 }
@@ -652,93 +733,76 @@ static mpc_err_t *mpc_err_file(const char *filename, const char *failure) {
 }
 
 static void mpc_err_delete_internal(mpc_input_t *i, mpc_err_t *x) {
-  int j;
   if (x == NULL) { return; }
-  for (j = 0; j < x->expected_num; j++) { mpc_free(i, x->expected[j]); }
   mpc_free(i, x->expected);
-  mpc_free(i, x->filename);
-  mpc_free(i, x->failure);
   mpc_free(i, x);
 }
 
+static char *mpc_err_strdup(const char *s) {
+  char *t;
+  if (s == NULL) { return NULL; }
+  t = malloc(strlen(s) + 1);
+  strcpy(t, s);
+  return t;
+}
+
 static mpc_err_t *mpc_err_export(mpc_input_t *i, mpc_err_t *x) {
   int j;
+  mpc_err_t *y = malloc(sizeof(mpc_err_t));
+  y->state = x->state;
+  y->expected_num = x->expected_num;
+  y->expected = x->expected_num ? malloc(sizeof(char*) * x->expected_num) : NULL;
   for (j = 0; j < x->expected_num; j++) {
-    x->expected[j] = mpc_export(i, x->expected[j]);
+    y->expected[j] = mpc_err_strdup(x->expected[j]);
   }
-  x->expected = mpc_export(i, x->expected);
-  x->filename = mpc_export(i, x->filename);
-  x->failure = mpc_export(i, x->failure);
-  return mpc_export(i, x);
+  y->filename = mpc_err_strdup(x->filename);
+  y->failure = mpc_err_strdup(x->failure);
+  y->recieved = x->recieved;
+  mpc_err_delete_internal(i, x);
+  return y;
 }
 
 static int mpc_err_contains_expected(mpc_input_t *i, mpc_err_t *x, char *expected) {
   int j;
   (void)i;
   for (j = 0; j < x->expected_num; j++) {
-    if (strcmp(x->expected[j], expected) == 0) { return 1; }
+    if (x->expected[j] == expected || strcmp(x->expected[j], expected) == 0) { return 1; }
   }
   return 0;
 }
 
 static void mpc_err_add_expected(mpc_input_t *i, mpc_err_t *x, char *expected) {
-  (void)i;
   x->expected_num++;
   x->expected = mpc_realloc(i, x->expected, sizeof(char*) * x->expected_num);
-  x->expected[x->expected_num-1] = mpc_malloc(i, strlen(expected) + 1);
-  strcpy(x->expected[x->expected_num-1], expected);
+  x->expected[x->expected_num-1] = expected;
 }
 
-static mpc_err_t *mpc_err_or(mpc_input_t *i, mpc_err_t** x, int n) {
-  
-  int j, k, fst;
-  mpc_err_t *e;
-  
-  fst = -1;
-  for (j = 0; j < n; j++) {
-    if (x[j] != NULL) { fst = j; }
-  }
-  
-  if (fst == -1) { return NULL; }
-  
-  e = mpc_malloc(i, sizeof(mpc_err_t));
-  e->state = mpc_state_invalid();
-  e->expected_num = 0;
-  e->expected = NULL;
-  e->failure = NULL;
-  e->filename = mpc_malloc(i, strlen(x[fst]->filename)+1);
-  strcpy(e->filename, x[fst]->filename);
+/*
+** Messages made while parsing, for repeats which
+** failed, belong to the input. Each is kept once
+** however often it comes up, so is only built the
+** first time.
+*/
+
+static char *mpc_input_intern(mpc_input_t *i, const char *prefix, const char *s) {
   
-  for (j = 0; j < n; j++) {
-    if (x[j] == NULL) { continue; }
-    if (x[j]->state.pos > e->state.pos) { e->state = x[j]->state; }
-  }
+  int j;
+  size_t l = strlen(prefix);
+  char *t;
   
-  for (j = 0; j < n; j++) {
-    if (x[j] == NULL) { continue; }
-    if (x[j]->state.pos < e->state.pos) { continue; }
-    
-    if (x[j]->failure) {
-      e->failure = mpc_malloc(i, strlen(x[j]->failure)+1);
-      strcpy(e->failure, x[j]->failure);
-      break;
-    }
-    
-    e->recieved = x[j]->recieved;
-    
-    for (k = 0; k < x[j]->expected_num; k++) {
-      if (!mpc_err_contains_expected(i, e, x[j]->expected[k])) {
-        mpc_err_add_expected(i, e, x[j]->expected[k]);
-      }
-    }
+  for (j = 0; j < i->strs_num; j++) {
+    t = i->strs[j];
+    if (strncmp(t, prefix, l) == 0 && strcmp(t + l, s) == 0) { return t; }
   }
   
-  for (j = 0; j < n; j++) {
-    if (x[j] == NULL) { continue; }
-    mpc_err_delete_internal(i, x[j]);
-  }
+  t = malloc(l + strlen(s) + 1);
+  strcpy(t, prefix);
+  strcat(t, s);
   
-  return e;
+  i->strs_num++;
+  i->strs = realloc(i->strs, sizeof(char*) * i->strs_num);
+  i->strs[i->strs_num-1] = t;
+  return t;
 }
 
 static mpc_err_t *mpc_err_repeat(mpc_input_t *i, mpc_err_t *x, const char *prefix) {
@@ -750,25 +814,19 @@ static mpc_err_t *mpc_err_repeat(mpc_input_t *i, mpc_err_t *x, const char *prefi
   if (x == NULL) { return NULL; }
   
   if (x->expected_num == 0) {
-    expect = mpc_calloc(i, 1, 1);
     x->expected_num = 1;
     x->expected = mpc_realloc(i, x->expected, sizeof(char*) * x->expected_num);
-    x->expected[0] = expect;
+    x->expected[0] = "";
     return x;
   }
   
   else if (x->expected_num == 1) {
-    expect = mpc_malloc(i, strlen(prefix) + strlen(x->expected[0]) + 1);
-    strcpy(expect, prefix);
-    strcat(expect, x->expected[0]);
-    mpc_free(i, x->expected[0]);
-    x->expected[0] = expect;
+    x->expected[0] = mpc_input_intern(i, prefix, x->expected[0]);
     return x;
   }
   
   else if (x->expected_num > 1) {
     
-    l += strlen(prefix);
     for (j = 0; j < x->expected_num-2; j++) {
       l += strlen(x->expected[j]) + strlen(", ");
     }
@@ -776,21 +834,19 @@ static mpc_err_t *mpc_err_repeat(mpc_input_t *i, mpc_err_t *x, const char *prefi
     l += strlen(" or ");
     l += strlen(x->expected[x->expected_num-1]);
     
-    expect = mpc_malloc(i, l + 1);
+    expect = malloc(l + 1);
     
-    strcpy(expect, prefix);
+    expect[0] = '\0';
     for (j = 0; j < x->expected_num-2; j++) {
       strcat(expect, x->expected[j]); strcat(expect, ", ");
     }
     strcat(expect, x->expected[x->expected_num-2]);
     strcat(expect, " or ");
     strcat(expect, x->expected[x->expected_num-1]);
-
-    for (j = 0; j < x->expected_num; j++) { mpc_free(i, x->expected[j]); }
     
     x->expected_num = 1;
-    x->expected = mpc_realloc(i, x->expected, sizeof(char*) * x->expected_num);
-    x->expected[0] = expect;
+    x->expected[0] = mpc_input_intern(i, prefix, expect);
+    free(expect);
     return x;
   }
   
@@ -802,21 +858,42 @@ static mpc_err_t *mpc_err_many1(mpc_input_t *i, mpc_err_t *x) {
 }
 
 static mpc_err_t *mpc_err_count(mpc_input_t *i, mpc_err_t *x, int n) {
-  mpc_err_t *y;
-  int digits = n/10 + 1;
-  char *prefix;
-  prefix = mpc_malloc(i, digits + strlen(" of ") + 1);
+  char prefix[32];
   sprintf(prefix, "%i of ", n);
-  y = mpc_err_repeat(i, x, prefix);
-  mpc_free(i, prefix);
-  return y;
+  return mpc_err_repeat(i, x, prefix);
 }
 
+/*
+** Only the farthest error is kept, or at the same
+** place the first failure, or else everything that
+** was expected there, in order and without repeats.
+*/
+
 static mpc_err_t *mpc_err_merge(mpc_input_t *i, mpc_err_t *x, mpc_err_t *y) {
-  mpc_err_t *errs[2];
-  errs[0] = x;
-  errs[1] = y;
-  return mpc_err_or(i, errs, 2);
+  
+  int k;
+  
+  if (x == NULL) { return y; }
+  if (y == NULL) { return x; }
+  
+  if (y->state.pos > x->state.pos) { mpc_err_delete_internal(i, x); return y; }
+  if (y->state.pos < x->state.pos || x->failure) { mpc_err_delete_internal(i, y); return x; }
+  
+  if (y->failure) {
+    x->failure = y->failure;
+    mpc_err_delete_internal(i, y);
+    return x;
+  }
+  
+  x->recieved = y->recieved;
+  for (k = 0; k < y->expected_num; k++) {
+    if (!mpc_err_contains_expected(i, x, y->expected[k])) {
+      mpc_err_add_expected(i, x, y->expected[k]);
+    }
+  }
+  
+  mpc_err_delete_internal(i, y);
+  return x;
 }
 
 /*
@@ -851,9 +928,16 @@ enum {
   MPC_TYPE_COUNT     = 22,
   
   MPC_TYPE_OR        = 23,
-  MPC_TYPE_AND       = 24
+  MPC_TYPE_AND       = 24,
+  
+  MPC_TYPE_DFA       = 25,
+  MPC_TYPE_MEMO      = 26,
+  MPC_TYPE_ARENA     = 27
 };
 
+typedef struct mpc_dfa_t mpc_dfa_t;
+typedef struct mpc_dispatch_t mpc_dispatch_t;
+
 typedef struct { char *m; } mpc_pdata_fail_t;
 typedef struct { mpc_ctor_t lf; void *x; } mpc_pdata_lift_t;
 typedef struct { mpc_parser_t *x; char *m; } mpc_pdata_expect_t;
@@ -867,8 +951,11 @@ typedef struct { mpc_parser_t *x; mpc_apply_to_t f; void *d; } mpc_pdata_apply_t
 typedef struct { mpc_parser_t *x; } mpc_pdata_predict_t;
 typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_ctor_t lf; } mpc_pdata_not_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_dtor_t dx; } mpc_pdata_repeat_t;
-typedef struct { int n; mpc_parser_t **xs; } mpc_pdata_or_t;
+typedef struct { int n; mpc_parser_t **xs; mpc_dispatch_t *d; } mpc_pdata_or_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t **xs; mpc_dtor_t *dxs;  } mpc_pdata_and_t;
+typedef struct { mpc_parser_t *x; mpc_dfa_t *d; } mpc_pdata_dfa_t;
+typedef struct { mpc_parser_t *x; unsigned long lookups; unsigned long hits; } mpc_pdata_memo_t;
+typedef struct { mpc_parser_t *x; } mpc_pdata_arena_t;
 
 typedef union {
   mpc_pdata_fail_t fail;
@@ -886,6 +973,9 @@ typedef union {
   mpc_pdata_repeat_t repeat;
   mpc_pdata_and_t and;
   mpc_pdata_or_t or;
+  mpc_pdata_dfa_t dfa;
+  mpc_pdata_memo_t memo;
+  mpc_pdata_arena_t arena;
 } mpc_pdata_t;
 
 struct mpc_parser_t {
@@ -915,6 +1005,20 @@ static mpc_val_t *mpcf_input_strfold(mpc_input_t *i, int n, mpc_val_t **xs) {
   return xs[0];
 }
 
+static mpc_arena_t *mpc_arena_new(void);
+static void mpc_arena_delete(mpc_arena_t *m);
+static void mpc_arena_ast_delete(mpc_arena_t *m, mpc_ast_t *a);
+static mpc_ast_t *mpc_arena_finish(mpc_arena_t *m, mpc_ast_t *a);
+static void *mpc_arena_alloc(mpc_arena_t *m, size_t n);
+static char *mpc_arena_intern(mpc_arena_t *m, const char *t);
+static char *mpc_arena_join(mpc_arena_t *m, const char *t, const char *tag);
+static mpc_ast_t *mpc_arena_adopt(mpc_arena_t *m, mpc_ast_t *a);
+static mpc_ast_t *mpc_arena_ast(mpc_arena_t *m, const char *tag, const char *contents);
+static mpc_val_t *mpc_arena_fold_ast(mpc_arena_t *m, int n, mpc_val_t **xs);
+static mpc_ast_t *mpc_arena_add_root(mpc_arena_t *m, mpc_ast_t *a);
+static mpc_ast_t *mpc_arena_tag(mpc_arena_t *m, mpc_ast_t *a, const char *t);
+static mpc_ast_t *mpc_arena_add_tag(mpc_arena_t *m, mpc_ast_t *a, const char *t);
+
 static mpc_val_t *mpcf_input_state_ast(mpc_input_t *i, int n, mpc_val_t **xs) {
   mpc_state_t *s = ((mpc_state_t**)xs)[0];
   mpc_ast_t *a = ((mpc_ast_t**)xs)[1];
@@ -935,6 +1039,7 @@ static mpc_val_t *mpc_parse_fold(mpc_input_t *i, mpc_fold_t f, int n, mpc_val_t
   if (f == mpcf_trd_free)  { return mpcf_input_trd_free(i, n, xs); }
   if (f == mpcf_strfold)   { return mpcf_input_strfold(i, n, xs); }
   if (f == mpcf_state_ast) { return mpcf_input_state_ast(i, n, xs); }
+  if (f == mpcf_fold_ast && i->arena) { return mpc_arena_fold_ast(i->arena, n, xs); }
   for (j = 0; j < n; j++) { xs[j] = mpc_export(i, xs[j]); }
   return f(j, xs);
 }
@@ -945,7 +1050,7 @@ static mpc_val_t *mpcf_input_free(mpc_input_t *i, mpc_val_t *x) {
 }
 
 static mpc_val_t *mpcf_input_str_ast(mpc_input_t *i, mpc_val_t *c) {
-  mpc_ast_t *a = mpc_ast_new("", c);
+  mpc_ast_t *a = i->arena ? mpc_arena_ast(i->arena, "", c) : mpc_ast_new("", c);
   mpc_free(i, c);
   return a;
 }
@@ -953,10 +1058,13 @@ static mpc_val_t *mpcf_input_str_ast(mpc_input_t *i, mpc_val_t *c) {
 static mpc_val_t *mpc_parse_apply(mpc_input_t *i, mpc_apply_t f, mpc_val_t *x) {
   if (f == mpcf_free)     { return mpcf_input_free(i, x); }
   if (f == mpcf_str_ast)  { return mpcf_input_str_ast(i, x); }
+  if (f == (mpc_apply_t)mpc_ast_add_root && i->arena) { return mpc_arena_add_root(i->arena, x); }
   return f(mpc_export(i, x));
 }
 
 static mpc_val_t *mpc_parse_apply_to(mpc_input_t *i, mpc_apply_to_t f, mpc_val_t *x, mpc_val_t *d) {
+  if (f == (mpc_apply_to_t)mpc_ast_tag && i->arena)     { return mpc_arena_tag(i->arena, x, d); }
+  if (f == (mpc_apply_to_t)mpc_ast_add_tag && i->arena) { return mpc_arena_add_tag(i->arena, x, d); }
   return f(mpc_export(i, x), d);
 }
 
@@ -965,241 +1073,394 @@ static void mpc_parse_dtor(mpc_input_t *i, mpc_dtor_t d, mpc_val_t *x) {
   d(mpc_export(i, x));
 }
 
+/*
+** Parsers are run by a machine with a stack of its
+** own rather than by recursion, so how deep input
+** can nest is only limited by memory. Each frame is
+** a parser part way through. It is entered once and
+** then resumed whenever a parser it started has
+** finished, with the result of that in `r`. The
+** outputs an `and` or repeat has collected so far
+** wait on a second stack until they are folded.
+*/
+
 enum {
-  MPC_PARSE_STACK_MIN = 4
+  MPC_PARSE_STACK_MIN = 64
 };
 
-#define MPC_SUCCESS(x) r->output = x; return 1
-#define MPC_FAILURE(x) r->error = x; return 0
-#define MPC_PRIMITIVE(x) \
-  if (x) { MPC_SUCCESS(r->output); } \
-  else { MPC_FAILURE(NULL); }
+enum {
+  MPC_PARSE_DEFER = -1,
+  MPC_PARSE_KEEP  = -2
+};
+
+typedef struct {
+  mpc_parser_t *p;
+  int j;            /* alternative or item being parsed */
+  int k;            /* dispatch step, or -1 once trying in order */
+  int base;         /* first of the outputs collected */
+  int flags;        /* memo key */
+  long pos;         /* where an `or` or memo started */
+  mpc_memo_t *m;    /* memo slot */
+  mpc_err_t *e;     /* errors from outside a memo */
+} mpc_frame_t;
+
+typedef struct {
+  int frames_num;
+  int frames_slots;
+  mpc_frame_t *frames;
+  int outputs_num;
+  int outputs_slots;
+  mpc_result_t *outputs;
+  mpc_frame_t frames_stk[MPC_PARSE_STACK_MIN];
+  mpc_result_t outputs_stk[MPC_PARSE_STACK_MIN];
+} mpc_stack_t;
+
+static void mpc_stack_grow(mpc_stack_t *s) {
+  
+  if (s->frames_num == s->frames_slots) {
+    s->frames_slots += s->frames_slots / 2;
+    if (s->frames == s->frames_stk) {
+      s->frames = malloc(sizeof(mpc_frame_t) * s->frames_slots);
+      memcpy(s->frames, s->frames_stk, sizeof(mpc_frame_t) * s->frames_num);
+    } else {
+      s->frames = realloc(s->frames, sizeof(mpc_frame_t) * s->frames_slots);
+    }
+  }
+  
+  if (s->outputs_num == s->outputs_slots) {
+    s->outputs_slots += s->outputs_slots / 2;
+    if (s->outputs == s->outputs_stk) {
+      s->outputs = malloc(sizeof(mpc_result_t) * s->outputs_slots);
+      memcpy(s->outputs, s->outputs_stk, sizeof(mpc_result_t) * s->outputs_num);
+    } else {
+      s->outputs = realloc(s->outputs, sizeof(mpc_result_t) * s->outputs_slots);
+    }
+  }
+  
+}
+
+static void mpc_stack_push(mpc_stack_t *s, mpc_parser_t *p) {
+  mpc_frame_t *f;
+  if (s->frames_num == s->frames_slots) { mpc_stack_grow(s); }
+  f = &s->frames[s->frames_num++];
+  f->p = p;
+  f->j = 0;
+  f->k = -1;
+  f->base = s->outputs_num;
+}
+
+static void mpc_stack_output(mpc_stack_t *s, mpc_result_t *r) {
+  if (s->outputs_num == s->outputs_slots) { mpc_stack_grow(s); }
+  s->outputs[s->outputs_num++] = *r;
+}
+
+static int mpc_parse_dfa(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e);
+static int mpc_dispatch_next(mpc_input_t *i, mpc_parser_t *p, long pos, int *k, mpc_err_t **e);
+static int mpc_memo_find(mpc_input_t *i, mpc_parser_t *p, mpc_frame_t *f, mpc_result_t *r, mpc_err_t **e);
+static void mpc_memo_keep(mpc_input_t *i, mpc_parser_t *p, mpc_frame_t *f, int ok, mpc_result_t *r, mpc_err_t *caught);
+
+#define MPC_SUCCESS(y) r->output = y; x = 1; break
+#define MPC_FAILURE(y) r->error = y; x = 0; break
+#define MPC_PRIMITIVE(y) \
+  if (y) { x = 1; } \
+  else { r->error = NULL; x = 0; } \
+  break
+#define MPC_CALL(q) mpc_stack_push(&s, q); resume = 0; continue
 
 static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
   
-  int j = 0, k = 0;
-  mpc_result_t results_stk[MPC_PARSE_STACK_MIN];
-  mpc_result_t *results;
-  int results_slots = MPC_PARSE_STACK_MIN;
+  int x = 0, k;
+  int resume = 0;
+  mpc_err_t *caught;
+  mpc_frame_t *f;
+  mpc_result_t *xs;
+  mpc_stack_t s;
   
-  switch (p->type) {
-      
-    /* Basic Parsers */
-
-    case MPC_TYPE_ANY:     MPC_PRIMITIVE(mpc_input_any(i, (char**)&r->output));
-    case MPC_TYPE_SINGLE:  MPC_PRIMITIVE(mpc_input_char(i, p->data.single.x, (char**)&r->output));
-    case MPC_TYPE_RANGE:   MPC_PRIMITIVE(mpc_input_range(i, p->data.range.x, p->data.range.y, (char**)&r->output));
-    case MPC_TYPE_ONEOF:   MPC_PRIMITIVE(mpc_input_oneof(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_NONEOF:  MPC_PRIMITIVE(mpc_input_noneof(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_SATISFY: MPC_PRIMITIVE(mpc_input_satisfy(i, p->data.satisfy.f, (char**)&r->output));
-    case MPC_TYPE_STRING:  MPC_PRIMITIVE(mpc_input_string(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_ANCHOR:  MPC_PRIMITIVE(mpc_input_anchor(i, p->data.anchor.f, (char**)&r->output));
-    
-    /* Other parsers */
-    
-    case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_err_fail(i, "Parser Undefined!"));
-    case MPC_TYPE_PASS:      MPC_SUCCESS(NULL);
-    case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_err_fail(i, p->data.fail.m));
-    case MPC_TYPE_LIFT:      MPC_SUCCESS(p->data.lift.lf());
-    case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(p->data.lift.x);
-    case MPC_TYPE_STATE:     MPC_SUCCESS(mpc_input_state_copy(i));
-    
-    /* Application Parsers */
-    
-    case MPC_TYPE_APPLY:
-      if (mpc_parse_run(i, p->data.apply.x, r, e)) {
-        MPC_SUCCESS(mpc_parse_apply(i, p->data.apply.f, r->output));
-      } else {
-        MPC_FAILURE(r->output);
-      }
-    
-    case MPC_TYPE_APPLY_TO:
-      if (mpc_parse_run(i, p->data.apply_to.x, r, e)) {
-        MPC_SUCCESS(mpc_parse_apply_to(i, p->data.apply_to.f, r->output, p->data.apply_to.d));
-      } else {
-        MPC_FAILURE(r->error);
-      }
-    
-    case MPC_TYPE_EXPECT:
-      mpc_input_suppress_enable(i);
-      if (mpc_parse_run(i, p->data.expect.x, r, e)) {
-        mpc_input_suppress_disable(i);
-        MPC_SUCCESS(r->output);
-      } else {
-        mpc_input_suppress_disable(i);
-        MPC_FAILURE(mpc_err_new(i, p->data.expect.m));
-      }
-    
-    case MPC_TYPE_PREDICT:
-      mpc_input_backtrack_disable(i);
-      if (mpc_parse_run(i, p->data.predict.x, r, e)) {      
-        mpc_input_backtrack_enable(i);
-        MPC_SUCCESS(r->output);
-      } else {
-        mpc_input_backtrack_enable(i);
-        MPC_FAILURE(r->error);
-      }
-    
-    /* Optional Parsers */
-    
-    /* TODO: Update Not Error Message */
-    
-    case MPC_TYPE_NOT:
-      mpc_input_mark(i);
-      mpc_input_suppress_enable(i);
-      if (mpc_parse_run(i, p->data.not.x, r, e)) {
-        mpc_input_rewind(i);
-        mpc_input_suppress_disable(i);
-        mpc_parse_dtor(i, p->data.not.dx, r->output);
-        MPC_FAILURE(mpc_err_new(i, "opposite"));
-      } else {
-        mpc_input_unmark(i);
-        mpc_input_suppress_disable(i);
-        MPC_SUCCESS(p->data.not.lf());
-      }
-    
-    case MPC_TYPE_MAYBE:
-      if (mpc_parse_run(i, p->data.not.x, r, e)) {
-        MPC_SUCCESS(r->output);
-      } else {
-        *e = mpc_err_merge(i, *e, r->error);
-        MPC_SUCCESS(p->data.not.lf());
-      }
-    
-    /* Repeat Parsers */
-    
-    case MPC_TYPE_MANY:
-      
-      results = results_stk;
-      
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e)) {
-        j++;
-        if (j == MPC_PARSE_STACK_MIN) {
-          results_slots = j + j / 2;
-          results = mpc_malloc(i, sizeof(mpc_result_t) * results_slots);
-          memcpy(results, results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
-        } else if (j >= results_slots) {
-          results_slots = j + j / 2;
-          results = mpc_realloc(i, results, sizeof(mpc_result_t) * results_slots);
-        }
-      }
-      
-      *e = mpc_err_merge(i, *e, results[j].error);
-      MPC_SUCCESS(
-        mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-        if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-    
-    case MPC_TYPE_MANY1:
-      
-      results = results_stk;
-      
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e)) {
-        j++;
-        if (j == MPC_PARSE_STACK_MIN) {
-          results_slots = j + j / 2;
-          results = mpc_malloc(i, sizeof(mpc_result_t) * results_slots);
-          memcpy(results, results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
-        } else if (j >= results_slots) {
-          results_slots = j + j / 2;
-          results = mpc_realloc(i, results, sizeof(mpc_result_t) * results_slots);
-        }
-      }
-      
-      if (j == 0) {
-        MPC_FAILURE(
-          mpc_err_many1(i, results[j].error);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      } else {
-        *e = mpc_err_merge(i, *e, results[j].error);
-        MPC_SUCCESS(
-          mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      }
+  s.frames_num = 0;
+  s.frames_slots = MPC_PARSE_STACK_MIN;
+  s.frames = s.frames_stk;
+  s.outputs_num = 0;
+  s.outputs_slots = MPC_PARSE_STACK_MIN;
+  s.outputs = s.outputs_stk;
+  
+  mpc_stack_push(&s, p);
+  
+  while (1) {
     
-    case MPC_TYPE_COUNT:
-      
-      results = p->data.repeat.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.repeat.n)
-        : results_stk;
-      
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e)) {
-        j++;
-        if (j == p->data.repeat.n) { break; }
-      }
-      
-      if (j == p->data.repeat.n) {
-        MPC_SUCCESS(
-          mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      } else {
-        for (k = 0; k < j; k++) {
-          mpc_parse_dtor(i, p->data.repeat.dx, results[k].output);
-        }
-        MPC_FAILURE(
-          mpc_err_count(i, results[j].error, p->data.repeat.n);
-          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });  
-      }
-      
-    /* Combinatory Parsers */
+    f = &s.frames[s.frames_num-1];
+    p = f->p;
+    xs = s.outputs + f->base;
     
-    case MPC_TYPE_OR:
+    if (!resume) {
       
-      if (p->data.or.n == 0) { MPC_SUCCESS(NULL); }
-      
-      results = p->data.or.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
-        : results_stk;
-      
-      for (j = 0; j < p->data.or.n; j++) {
-        if (mpc_parse_run(i, p->data.or.xs[j], &results[j], e)) {
-          MPC_SUCCESS(results[j].output;
-            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-        } else {
-          *e = mpc_err_merge(i, *e, results[j].error);
-        } 
+      switch (p->type) {
+        
+        /* Basic Parsers */
+        
+        case MPC_TYPE_ANY:     MPC_PRIMITIVE(mpc_input_any(i, (char**)&r->output));
+        case MPC_TYPE_SINGLE:  MPC_PRIMITIVE(mpc_input_char(i, p->data.single.x, (char**)&r->output));
+        case MPC_TYPE_RANGE:   MPC_PRIMITIVE(mpc_input_range(i, p->data.range.x, p->data.range.y, (char**)&r->output));
+        case MPC_TYPE_ONEOF:   MPC_PRIMITIVE(mpc_input_oneof(i, p->data.string.x, (char**)&r->output));
+        case MPC_TYPE_NONEOF:  MPC_PRIMITIVE(mpc_input_noneof(i, p->data.string.x, (char**)&r->output));
+        case MPC_TYPE_SATISFY: MPC_PRIMITIVE(mpc_input_satisfy(i, p->data.satisfy.f, (char**)&r->output));
+        case MPC_TYPE_STRING:  MPC_PRIMITIVE(mpc_input_string(i, p->data.string.x, (char**)&r->output));
+        case MPC_TYPE_ANCHOR:  MPC_PRIMITIVE(mpc_input_anchor(i, p->data.anchor.f, (char**)&r->output));
+        
+        /* Other parsers */
+        
+        case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_err_fail(i, "Parser Undefined!"));
+        case MPC_TYPE_PASS:      MPC_SUCCESS(NULL);
+        case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_err_fail(i, p->data.fail.m));
+        case MPC_TYPE_LIFT:      MPC_SUCCESS(p->data.lift.lf());
+        case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(p->data.lift.x);
+        case MPC_TYPE_STATE:     MPC_SUCCESS(mpc_input_state_copy(i));
+        
+        /* Application Parsers */
+        
+        case MPC_TYPE_APPLY:    MPC_CALL(p->data.apply.x);
+        case MPC_TYPE_APPLY_TO: MPC_CALL(p->data.apply_to.x);
+        
+        case MPC_TYPE_EXPECT:
+          mpc_input_suppress_enable(i);
+          MPC_CALL(p->data.expect.x);
+        
+        case MPC_TYPE_PREDICT:
+          mpc_input_backtrack_disable(i);
+          MPC_CALL(p->data.predict.x);
+        
+        /* Optional Parsers */
+        
+        case MPC_TYPE_NOT:
+          mpc_input_mark(i);
+          mpc_input_suppress_enable(i);
+          MPC_CALL(p->data.not.x);
+        
+        case MPC_TYPE_MAYBE: MPC_CALL(p->data.not.x);
+        
+        /* Repeat Parsers */
+        
+        case MPC_TYPE_MANY:
+        case MPC_TYPE_MANY1:
+        case MPC_TYPE_COUNT: MPC_CALL(p->data.repeat.x);
+        
+        /* Combinatory Parsers */
+        
+        case MPC_TYPE_OR:
+          
+          if (p->data.or.n == 0) { MPC_SUCCESS(NULL); }
+          
+          if (p->data.or.d && i->type == MPC_INPUT_STRING) {
+            f->pos = i->state.pos;
+            f->k = 0;
+            f->j = mpc_dispatch_next(i, p, f->pos, &f->k, e);
+            if (f->j < 0) { MPC_FAILURE(NULL); }
+          }
+          
+          MPC_CALL(p->data.or.xs[f->j]);
+        
+        case MPC_TYPE_AND:
+          
+          if (p->data.and.n == 0) { MPC_SUCCESS(NULL); }
+          
+          mpc_input_mark(i);
+          MPC_CALL(p->data.and.xs[0]);
+        
+        /* Compiled Parsers */
+        
+        case MPC_TYPE_DFA:
+          x = mpc_parse_dfa(i, p, r, e);
+          if (x == MPC_PARSE_DEFER) { f->p = p->data.dfa.x; continue; }
+          break;
+        
+        case MPC_TYPE_MEMO:
+          x = mpc_memo_find(i, p, f, r, e);
+          if (x == MPC_PARSE_DEFER) { f->p = p->data.memo.x; continue; }
+          if (x == MPC_PARSE_KEEP) {
+            f->e = *e;
+            *e = NULL;
+            MPC_CALL(p->data.memo.x);
+          }
+          break;
+        
+        /* Only the rule a parse starts from owns the arena */
+        
+        case MPC_TYPE_ARENA:
+          if (i->arena || s.frames_num > 1) { f->p = p->data.arena.x; continue; }
+          i->arena = mpc_arena_new();
+          MPC_CALL(p->data.arena.x);
+        
+        /* End */
+        
+        default: MPC_FAILURE(mpc_err_fail(i, "Unknown Parser Type Id!"));
       }
-      
-      MPC_FAILURE(NULL;
-        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
     
-    case MPC_TYPE_AND:
-      
-      if (p->data.and.n == 0) { MPC_SUCCESS(NULL); }
-      
-      results = p->data.or.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
-        : results_stk;
+    } else {
       
-      mpc_input_mark(i);
-      for (j = 0; j < p->data.and.n; j++) {
-        if (!mpc_parse_run(i, p->data.and.xs[j], &results[j], e)) {
+      switch (p->type) {
+        
+        /* Application Parsers */
+        
+        case MPC_TYPE_APPLY:
+          if (x) { r->output = mpc_parse_apply(i, p->data.apply.f, r->output); }
+          break;
+        
+        case MPC_TYPE_APPLY_TO:
+          if (x) { r->output = mpc_parse_apply_to(i, p->data.apply_to.f, r->output, p->data.apply_to.d); }
+          break;
+        
+        case MPC_TYPE_EXPECT:
+          mpc_input_suppress_disable(i);
+          if (x) { break; }
+          MPC_FAILURE(mpc_err_new(i, p->data.expect.m));
+        
+        case MPC_TYPE_PREDICT:
+          mpc_input_backtrack_enable(i);
+          break;
+        
+        /* Optional Parsers */
+        
+        /* TODO: Update Not Error Message */
+        
+        case MPC_TYPE_NOT:
+          if (x) {
+            mpc_input_rewind(i);
+            mpc_input_suppress_disable(i);
+            mpc_parse_dtor(i, p->data.not.dx, r->output);
+            MPC_FAILURE(mpc_err_new(i, "opposite"));
+          }
+          mpc_input_unmark(i);
+          mpc_input_suppress_disable(i);
+          MPC_SUCCESS(p->data.not.lf());
+        
+        case MPC_TYPE_MAYBE:
+          if (x) { break; }
+          *e = mpc_err_merge(i, *e, r->error);
+          MPC_SUCCESS(p->data.not.lf());
+        
+        /* Repeat Parsers */
+        
+        case MPC_TYPE_MANY:
+        case MPC_TYPE_MANY1:
+          
+          if (x) {
+            mpc_stack_output(&s, r);
+            f->j++;
+            MPC_CALL(p->data.repeat.x);
+          }
+          
+          if (p->type == MPC_TYPE_MANY1 && f->j == 0) {
+            MPC_FAILURE(mpc_err_many1(i, r->error));
+          }
+          
+          *e = mpc_err_merge(i, *e, r->error);
+          s.outputs_num = f->base;
+          MPC_SUCCESS(mpc_parse_fold(i, p->data.repeat.f, f->j, (mpc_val_t**)xs));
+        
+        case MPC_TYPE_COUNT:
+          
+          if (x) {
+            mpc_stack_output(&s, r);
+            f->j++;
+            if (f->j != p->data.repeat.n) { MPC_CALL(p->data.repeat.x); }
+            s.outputs_num = f->base;
+            xs = s.outputs + f->base;
+            MPC_SUCCESS(mpc_parse_fold(i, p->data.repeat.f, f->j, (mpc_val_t**)xs));
+          }
+          
+          s.outputs_num = f->base;
+          
+          if (f->j == p->data.repeat.n) {
+            mpc_err_delete_internal(i, r->error);
+            MPC_SUCCESS(mpc_parse_fold(i, p->data.repeat.f, f->j, (mpc_val_t**)xs));
+          }
+          
+          for (k = 0; k < f->j; k++) {
+            mpc_parse_dtor(i, p->data.repeat.dx, xs[k].output);
+          }
+          MPC_FAILURE(mpc_err_count(i, r->error, p->data.repeat.n));
+        
+        /* Combinatory Parsers */
+        
+        case MPC_TYPE_OR:
+          
+          if (x) { break; }
+          
+          *e = mpc_err_merge(i, *e, r->error);
+          
+          /* Not everything rewinds, and then the rest start further on */
+          
+          if (f->k >= 0 && i->state.pos == f->pos) {
+            f->k++;
+            f->j = mpc_dispatch_next(i, p, f->pos, &f->k, e);
+            if (f->j < 0) { MPC_FAILURE(NULL); }
+            MPC_CALL(p->data.or.xs[f->j]);
+          }
+          
+          f->k = -1;
+          f->j++;
+          if (f->j < p->data.or.n) { MPC_CALL(p->data.or.xs[f->j]); }
+          MPC_FAILURE(NULL);
+        
+        case MPC_TYPE_AND:
+          
+          if (x) {
+            mpc_stack_output(&s, r);
+            f->j++;
+            if (f->j < p->data.and.n) { MPC_CALL(p->data.and.xs[f->j]); }
+            mpc_input_unmark(i);
+            s.outputs_num = f->base;
+            xs = s.outputs + f->base;
+            MPC_SUCCESS(mpc_parse_fold(i, p->data.and.f, f->j, (mpc_val_t**)xs));
+          }
+          
           mpc_input_rewind(i);
-          for (k = 0; k < j; k++) {
-            mpc_parse_dtor(i, p->data.and.dxs[k], results[k].output);
+          for (k = 0; k < f->j; k++) {
+            mpc_parse_dtor(i, p->data.and.dxs[k], xs[k].output);
           }
-          MPC_FAILURE(results[j].error;
-            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-        }
+          s.outputs_num = f->base;
+          break;
+        
+        /* Compiled Parsers */
+        
+        case MPC_TYPE_MEMO:
+          caught = *e;
+          *e = f->e;
+          mpc_memo_keep(i, p, f, x, r, caught);
+          *e = mpc_err_merge(i, *e, caught);
+          break;
+        
+        case MPC_TYPE_ARENA:
+          if (x) {
+            r->output = mpc_arena_finish(i->arena, r->output);
+          } else {
+            mpc_arena_delete(i->arena);
+          }
+          i->arena = NULL;
+          break;
+        
+        default: break;
       }
-      mpc_input_unmark(i); 
-      MPC_SUCCESS(
-        mpc_parse_fold(i, p->data.and.f, j, (mpc_val_t**)results);
-        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
     
-    /* End */
+    }
     
-    default:
-      
-      MPC_FAILURE(mpc_err_fail(i, "Unknown Parser Type Id!"));
+    /* Finished, so hand the result back */
+    
+    s.frames_num--;
+    if (s.frames_num == 0) { break; }
+    resume = 1;
   }
   
-  return 0;
+  if (s.frames != s.frames_stk) { free(s.frames); }
+  if (s.outputs != s.outputs_stk) { free(s.outputs); }
   
+  return x;
+
 }
 
 #undef MPC_SUCCESS
 #undef MPC_FAILURE
 #undef MPC_PRIMITIVE
+#undef MPC_CALL
 
 int mpc_parse_input(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
   int x;
@@ -1223,6 +1484,14 @@ int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_res
   return x;
 }
 
+int mpc_nparse(const char *filename, const char *string, long length, mpc_parser_t *p, mpc_result_t *r) {
+  int x;
+  mpc_input_t *i = mpc_input_new_nstring(filename, string, length);
+  x = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
+  return x;
+}
+
 int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r) {
   int x;
   mpc_input_t *i = mpc_input_new_file(filename, file);
@@ -1239,19 +1508,57 @@ int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result
   return x;
 }
 
+/*
+** The whole file is parsed as an in memory string. Where possible regular
+** files are mapped rather than read, otherwise the file is read in blocks
+** into a buffer that doubles as it fills.
+*/
+
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
   
-  FILE *f = fopen(filename, "rb");
+  FILE *f;
+  char *data;
+  size_t n;
+  long length = 0;
+  long cap = 4096;
   int res;
   
+#ifdef MPC_USE_MMAP
+  struct stat st;
+  int fd = open(filename, O_RDONLY);
+  
+  if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      close(fd);
+      res = mpc_nparse(filename, data, (long)st.st_size, p, r);
+      munmap(data, st.st_size);
+      return res;
+    }
+  }
+  if (fd >= 0) { close(fd); }
+#endif
+  
+  f = fopen(filename, "rb");
+  
   if (f == NULL) {
     r->output = NULL;
     r->error = mpc_err_file(filename, "Unable to open file!");
     return 0;
   }
   
-  res = mpc_parse_file(filename, f, p, r);
+  data = malloc(cap);
+  while ((n = fread(data + length, 1, cap - length, f)) > 0) {
+    length += (long)n;
+    if (length == cap) {
+      cap *= 2;
+      data = realloc(data, cap);
+    }
+  }
   fclose(f);
+  
+  res = mpc_nparse(filename, data, length, p, r);
+  free(data);
   return res;
 }
 
@@ -1260,6 +1567,10 @@ int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
 */
 
 static void mpc_undefine_unretained(mpc_parser_t *p, int force);
+static mpc_dfa_t *mpc_dfa_new(mpc_parser_t *p);
+static void mpc_dfa_delete(mpc_dfa_t *d);
+static mpc_dispatch_t *mpc_dispatch_new(mpc_parser_t *p);
+static void mpc_dispatch_delete(mpc_dispatch_t *d);
 
 static void mpc_undefine_or(mpc_parser_t *p) {
   
@@ -1268,6 +1579,7 @@ static void mpc_undefine_or(mpc_parser_t *p) {
     mpc_undefine_unretained(p->data.or.xs[i], 0);
   }
   free(p->data.or.xs);
+  mpc_dispatch_delete(p->data.or.d);
   
 }
 
@@ -1319,6 +1631,14 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
     case MPC_TYPE_OR:  mpc_undefine_or(p);  break;
     case MPC_TYPE_AND: mpc_undefine_and(p); break;
     
+    case MPC_TYPE_DFA:
+      mpc_undefine_unretained(p->data.dfa.x, 0);
+      mpc_dfa_delete(p->data.dfa.d);
+      break;
+    
+    case MPC_TYPE_MEMO:  mpc_undefine_unretained(p->data.memo.x, 0); break;
+    case MPC_TYPE_ARENA: mpc_undefine_unretained(p->data.arena.x, 0); break;
+    
     default: break;
   }
   
@@ -1420,6 +1740,7 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
       for (i = 0; i < a->data.or.n; i++) {
         p->data.or.xs[i] = mpc_copy(a->data.or.xs[i]);
       }
+      p->data.or.d = a->data.or.d ? mpc_dispatch_new(p) : NULL;
     break;
     case MPC_TYPE_AND:
       p->data.and.xs = malloc(a->data.and.n * sizeof(mpc_parser_t*));
@@ -1432,6 +1753,21 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
       }
     break;
     
+    case MPC_TYPE_DFA:
+      p->data.dfa.x = mpc_copy(a->data.dfa.x);
+      p->data.dfa.d = mpc_dfa_new(p->data.dfa.x);
+    break;
+    
+    case MPC_TYPE_MEMO:
+      p->data.memo.x = mpc_copy(a->data.memo.x);
+      p->data.memo.lookups = 0;
+      p->data.memo.hits = 0;
+    break;
+    
+    case MPC_TYPE_ARENA:
+      p->data.arena.x = mpc_copy(a->data.arena.x);
+    break;
+    
     default: break;
   }
 
@@ -2117,40 +2453,655 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
   return out;
 }
 
-mpc_parser_t *mpc_re(const char *re) {
-  
-  char *err_msg;
-  mpc_parser_t *err_out;
-  mpc_result_t r;
-  mpc_parser_t *Regex, *Term, *Factor, *Base, *Range, *RegexEnclose; 
-  
-  Regex  = mpc_new("regex");
-  Term   = mpc_new("term");
-  Factor = mpc_new("factor");
-  Base   = mpc_new("base");
-  Range  = mpc_new("range");
-  
-  mpc_define(Regex, mpc_and(2, mpcf_re_or,
-    Term, 
-    mpc_maybe(mpc_and(2, mpcf_snd_free, mpc_char('|'), Regex, free)),
-    (mpc_dtor_t)mpc_delete
-  ));
-  
-  mpc_define(Term, mpc_many(mpcf_re_and, Factor));
-  
-  mpc_define(Factor, mpc_and(2, mpcf_re_repeat,
-    Base,
-    mpc_or(5,
-      mpc_char('*'), mpc_char('+'), mpc_char('?'),
-      mpc_brackets(mpc_int(), free),
-      mpc_pass()),
-    (mpc_dtor_t)mpc_delete
-  ));
-  
-  mpc_define(Base, mpc_or(4,
-    mpc_parens(Regex, (mpc_dtor_t)mpc_delete),
-    mpc_squares(Range, (mpc_dtor_t)mpc_delete),
-    mpc_apply(mpc_escape(), mpcf_re_escape),
+/*
+** Regular Expression DFA
+*/
+
+/*
+** The parsers built by `mpc_re` are run one
+** character at a time, going up and down the
+** combinators for every character. Most regex
+** however never need to backtrack - the next
+** character alone is enough to say which way
+** every `or` and repeat will go. These regex
+** are compiled to a DFA over byte classes and
+** matched with a table walk.
+**
+** A state of the DFA is the path from the top
+** of the regex down to the character parser
+** which consumed the last character, along
+** with the position in each `and`, `or` and
+** repeat on the way. Moving to the next state
+** does exactly what the combinators would do
+** for the next character, so the match is the
+** same. Where the combinators would have to
+** rewind after consuming some input the DFA
+** gives up and runs the combinators instead.
+**
+** Failing parsers also leave errors behind
+** in a match, from each `many`, `maybe` and
+** `or` which stops or moves on. Only those
+** at the last place this happened can end up
+** in the final error, so instead of building
+** them as it goes the DFA just remembers that
+** step and replays it at the end. A failed
+** match likewise replays only its last step.
+*/
+
+enum {
+  MPC_DFA_ACCEPT    = -1,
+  MPC_DFA_FAIL      = -2,
+  MPC_DFA_BACKTRACK = -3
+};
+
+enum {
+  MPC_DFA_LEAF  = 0,
+  MPC_DFA_EMPTY = 1,
+  MPC_DFA_NONE  = 2
+};
+
+enum {
+  MPC_DFA_DEPTH_MAX  = 64,
+  MPC_DFA_STATES_MAX = 1024,
+  MPC_DFA_LEAVES_MAX = 256
+};
+
+typedef struct {
+  mpc_parser_t *x;
+  int n;
+} mpc_dfa_step_t;
+
+typedef struct {
+  int depth;
+  mpc_dfa_step_t *path;
+} mpc_dfa_state_t;
+
+struct mpc_dfa_t {
+  mpc_parser_t *root;
+  int states_num;
+  mpc_dfa_state_t *states;
+  int classes_num;
+  unsigned char classes[257];
+  short *trans;
+  char *catches;
+};
+
+typedef struct {
+  mpc_parser_t *root;
+  mpc_input_t *i;
+  mpc_err_t **e;
+  mpc_err_t *err;
+  int c;
+  int catches;
+  int depth;
+  mpc_dfa_step_t path[MPC_DFA_DEPTH_MAX];
+} mpc_dfa_walk_t;
+
+/* Does a character parser take byte `c`, where 256 is the end of input */
+static int mpc_dfa_match(mpc_parser_t *p, int c) {
+  if (c == 256) { return 0; }
+  switch (p->type) {
+    case MPC_TYPE_ANY:    return 1;
+    case MPC_TYPE_SINGLE: return (char)c == p->data.single.x;
+    case MPC_TYPE_RANGE:  return (char)c >= p->data.range.x && (char)c <= p->data.range.y;
+    case MPC_TYPE_ONEOF:  return strchr(p->data.string.x, (char)c) != 0;
+    case MPC_TYPE_NONEOF: return strchr(p->data.string.x, (char)c) == 0;
+    default: return 0;
+  }
+}
+
+static int mpc_dfa_nullable(mpc_parser_t *p) {
+  int j;
+  switch (p->type) {
+    case MPC_TYPE_LIFT:
+    case MPC_TYPE_MAYBE:
+    case MPC_TYPE_MANY:  return 1;
+    case MPC_TYPE_EXPECT: return mpc_dfa_nullable(p->data.expect.x);
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT: return mpc_dfa_nullable(p->data.repeat.x);
+    case MPC_TYPE_AND:
+      for (j = 0; j < p->data.and.n; j++) {
+        if (!mpc_dfa_nullable(p->data.and.xs[j])) { return 0; }
+      }
+      return 1;
+    case MPC_TYPE_OR:
+      if (p->data.or.n == 0) { return 1; }
+      for (j = 0; j < p->data.or.n; j++) {
+        if (mpc_dfa_nullable(p->data.or.xs[j])) { return 1; }
+      }
+      return 0;
+    default: return 0;
+  }
+}
+
+/*
+** Only the combinators `mpc_re` builds are
+** compiled, and only when they fold strings
+** together as `mpc_re` does. Character parsers
+** must give their own error, as they all do in
+** `mpc_re`, and repeats of things which can
+** match nothing are left alone.
+*/
+
+static int mpc_dfa_leaf(mpc_parser_t *p) {
+  return p->type == MPC_TYPE_ANY
+    || p->type == MPC_TYPE_SINGLE
+    || p->type == MPC_TYPE_RANGE
+    || p->type == MPC_TYPE_ONEOF
+    || p->type == MPC_TYPE_NONEOF;
+}
+
+static int mpc_dfa_supported(mpc_parser_t *p, int depth, mpc_parser_t **leaves, int *leaves_num) {
+  
+  int j;
+  
+  if (depth >= MPC_DFA_DEPTH_MAX || p->retained) { return 0; }
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_LIFT:
+      return p->data.lift.lf == mpcf_ctor_str;
+    
+    case MPC_TYPE_EXPECT:
+      if (mpc_dfa_leaf(p->data.expect.x) && !p->data.expect.x->retained) {
+        if (*leaves_num == MPC_DFA_LEAVES_MAX) { return 0; }
+        leaves[(*leaves_num)++] = p->data.expect.x;
+        return depth+1 < MPC_DFA_DEPTH_MAX;
+      }
+      return mpc_dfa_supported(p->data.expect.x, depth+1, leaves, leaves_num);
+    
+    case MPC_TYPE_MAYBE:
+      return p->data.not.lf == mpcf_ctor_str
+        && mpc_dfa_supported(p->data.not.x, depth+1, leaves, leaves_num);
+    
+    case MPC_TYPE_COUNT:
+      if (p->data.repeat.n < 1) { return 0; }
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+      return p->data.repeat.f == mpcf_strfold
+        && !mpc_dfa_nullable(p->data.repeat.x)
+        && mpc_dfa_supported(p->data.repeat.x, depth+1, leaves, leaves_num);
+    
+    case MPC_TYPE_AND:
+      if (p->data.and.f != mpcf_strfold) { return 0; }
+      for (j = 0; j < p->data.and.n; j++) {
+        if (!mpc_dfa_supported(p->data.and.xs[j], depth+1, leaves, leaves_num)) { return 0; }
+      }
+      return 1;
+    
+    case MPC_TYPE_OR:
+      for (j = 0; j < p->data.or.n; j++) {
+        if (!mpc_dfa_supported(p->data.or.xs[j], depth+1, leaves, leaves_num)) { return 0; }
+      }
+      return 1;
+    
+    default: return 0;
+  }
+  
+}
+
+/*
+** Merge the error of a failed parser into the
+** errors left behind, as `maybe`, `many` and
+** `or` do. When compiling there is no input and
+** all that is noted is that it happened.
+*/
+
+static void mpc_dfa_catch(mpc_dfa_walk_t *w, mpc_err_t *x) {
+  w->catches = 1;
+  if (w->i) { *w->e = mpc_err_merge(w->i, *w->e, x); }
+}
+
+/*
+** Enter parser `p` with the next byte, pushing
+** the path to the character parser which takes
+** it, or finding it matches nothing, or fails
+** without consuming anything. These are all the
+** combinators can do with a single character.
+*/
+
+static int mpc_dfa_enter(mpc_dfa_walk_t *w, mpc_parser_t *p, mpc_err_t **err) {
+  
+  int j, r;
+  int depth = w->depth;
+  mpc_err_t *x = NULL;
+  
+  *err = NULL;
+  w->path[depth].x = p;
+  w->path[depth].n = 0;
+  w->depth++;
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_LIFT:
+      w->depth = depth;
+      return MPC_DFA_EMPTY;
+    
+    case MPC_TYPE_EXPECT:
+      if (w->i) { mpc_input_suppress_enable(w->i); }
+      r = mpc_dfa_enter(w, p->data.expect.x, &x);
+      if (w->i) { mpc_input_suppress_disable(w->i); }
+      if (r == MPC_DFA_LEAF) { return r; }
+      w->depth = depth;
+      if (r == MPC_DFA_NONE && w->i) { *err = mpc_err_new(w->i, p->data.expect.m); }
+      return r;
+    
+    case MPC_TYPE_MAYBE:
+      r = mpc_dfa_enter(w, p->data.not.x, &x);
+      if (r == MPC_DFA_LEAF) { return r; }
+      w->depth = depth;
+      if (r == MPC_DFA_NONE) { mpc_dfa_catch(w, x); }
+      return MPC_DFA_EMPTY;
+    
+    case MPC_TYPE_MANY:
+      r = mpc_dfa_enter(w, p->data.repeat.x, &x);
+      if (r == MPC_DFA_LEAF) { return r; }
+      w->depth = depth;
+      mpc_dfa_catch(w, x);
+      return MPC_DFA_EMPTY;
+    
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      r = mpc_dfa_enter(w, p->data.repeat.x, &x);
+      if (r == MPC_DFA_LEAF) { return r; }
+      w->depth = depth;
+      if (w->i) {
+        *err = p->type == MPC_TYPE_MANY1
+          ? mpc_err_many1(w->i, x)
+          : mpc_err_count(w->i, x, p->data.repeat.n);
+      }
+      return MPC_DFA_NONE;
+    
+    case MPC_TYPE_AND:
+      for (j = 0; j < p->data.and.n; j++) {
+        w->path[depth].n = j;
+        r = mpc_dfa_enter(w, p->data.and.xs[j], &x);
+        if (r == MPC_DFA_LEAF) { return r; }
+        if (r == MPC_DFA_NONE) {
+          w->depth = depth;
+          *err = x;
+          return r;
+        }
+      }
+      w->depth = depth;
+      return MPC_DFA_EMPTY;
+    
+    case MPC_TYPE_OR:
+      if (p->data.or.n == 0) { w->depth = depth; return MPC_DFA_EMPTY; }
+      for (j = 0; j < p->data.or.n; j++) {
+        w->path[depth].n = j;
+        r = mpc_dfa_enter(w, p->data.or.xs[j], &x);
+        if (r == MPC_DFA_LEAF) { return r; }
+        if (r == MPC_DFA_EMPTY) { w->depth = depth; return r; }
+        mpc_dfa_catch(w, x);
+      }
+      w->depth = depth;
+      return MPC_DFA_NONE;
+    
+    default:
+      if (mpc_dfa_match(p, w->c)) { return MPC_DFA_LEAF; }
+      w->depth = depth;
+      return MPC_DFA_NONE;
+  }
+  
+}
+
+/*
+** A failure after consuming input fails the
+** whole regex unless something above catches
+** it and carries on from where it started,
+** in which case it is left to the combinators.
+** They are also left to build the error when
+** an `expect` above would give it from the
+** place the input was rewound to, or when the
+** input is not rewound all the way back.
+*/
+
+static int mpc_dfa_fail(mpc_dfa_walk_t *w, int k, mpc_err_t *x) {
+  
+  mpc_parser_t *p;
+  
+  for (; k >= 0; k--) {
+    
+    p = w->path[k].x;
+    
+    switch (p->type) {
+      
+      case MPC_TYPE_OR:
+      case MPC_TYPE_MAYBE:
+      case MPC_TYPE_MANY:
+      case MPC_TYPE_EXPECT:
+        if (w->i) { mpc_err_delete_internal(w->i, x); }
+        return MPC_DFA_BACKTRACK;
+      
+      case MPC_TYPE_MANY1:
+        if (w->path[k].n > 0) {
+          if (w->i) { mpc_err_delete_internal(w->i, x); }
+          return MPC_DFA_BACKTRACK;
+        }
+        if (w->i) { x = mpc_err_many1(w->i, x); }
+        break;
+      
+      case MPC_TYPE_COUNT:
+        if (w->i) { x = mpc_err_count(w->i, x, p->data.repeat.n); }
+        break;
+      
+      default: break;
+    }
+  }
+  
+  if (w->path[0].x->type != MPC_TYPE_AND) {
+    if (w->i) { mpc_err_delete_internal(w->i, x); }
+    return MPC_DFA_BACKTRACK;
+  }
+  
+  w->err = x;
+  return MPC_DFA_FAIL;
+}
+
+/*
+** Take one step from a state with the next
+** byte. Either the path moves down to the next
+** character parser, or the walk comes back up
+** to the top and the match ends before this
+** byte, or the regex fails here.
+*/
+
+static int mpc_dfa_step(mpc_dfa_walk_t *w) {
+  
+  int k, r;
+  mpc_parser_t *p;
+  mpc_err_t *x = NULL;
+  
+  if (w->depth == 0) {
+    r = mpc_dfa_enter(w, w->root, &x);
+    if (r == MPC_DFA_LEAF)  { return r; }
+    if (r == MPC_DFA_EMPTY) { return MPC_DFA_ACCEPT; }
+    w->err = x;
+    return MPC_DFA_FAIL;
+  }
+  
+  for (k = w->depth-2; k >= 0; k--) {
+    
+    p = w->path[k].x;
+    w->depth = k+1;
+    
+    switch (p->type) {
+      
+      case MPC_TYPE_EXPECT:
+        if (w->i) { mpc_input_suppress_disable(w->i); }
+        break;
+      
+      case MPC_TYPE_AND:
+        while (++w->path[k].n < p->data.and.n) {
+          r = mpc_dfa_enter(w, p->data.and.xs[w->path[k].n], &x);
+          if (r == MPC_DFA_LEAF) { return r; }
+          if (r == MPC_DFA_NONE) { return mpc_dfa_fail(w, k, x); }
+        }
+        break;
+      
+      case MPC_TYPE_MANY1:
+        w->path[k].n = 1;
+      case MPC_TYPE_MANY:
+        r = mpc_dfa_enter(w, p->data.repeat.x, &x);
+        if (r == MPC_DFA_LEAF) { return r; }
+        mpc_dfa_catch(w, x);
+        break;
+      
+      case MPC_TYPE_COUNT:
+        if (++w->path[k].n == p->data.repeat.n) { break; }
+        r = mpc_dfa_enter(w, p->data.repeat.x, &x);
+        if (r == MPC_DFA_LEAF) { return r; }
+        return mpc_dfa_fail(w, k, x);
+      
+      default: break;
+    }
+  }
+  
+  return MPC_DFA_ACCEPT;
+}
+
+static int mpc_dfa_state_find(mpc_dfa_t *d, mpc_dfa_walk_t *w) {
+  
+  int j, k;
+  mpc_dfa_state_t *s;
+  
+  for (j = 0; j < d->states_num; j++) {
+    s = &d->states[j];
+    if (s->depth != w->depth) { continue; }
+    for (k = 0; k < s->depth; k++) {
+      if (s->path[k].x != w->path[k].x || s->path[k].n != w->path[k].n) { break; }
+    }
+    if (k == s->depth) { return j; }
+  }
+  
+  if (d->states_num == MPC_DFA_STATES_MAX) { return -1; }
+  
+  d->states = realloc(d->states, sizeof(mpc_dfa_state_t) * (d->states_num+1));
+  s = &d->states[d->states_num];
+  s->depth = w->depth;
+  s->path = malloc(sizeof(mpc_dfa_step_t) * (w->depth > 0 ? w->depth : 1));
+  memcpy(s->path, w->path, sizeof(mpc_dfa_step_t) * w->depth);
+  return d->states_num++;
+}
+
+static void mpc_dfa_delete(mpc_dfa_t *d) {
+  int j;
+  if (d == NULL) { return; }
+  for (j = 0; j < d->states_num; j++) { free(d->states[j].path); }
+  free(d->states);
+  free(d->trans);
+  free(d->catches);
+  free(d);
+}
+
+static mpc_dfa_t *mpc_dfa_new(mpc_parser_t *p) {
+  
+  int c, j, k, r, s;
+  int leaves_num = 0;
+  int reps[257];
+  char sigs[257][MPC_DFA_LEAVES_MAX];
+  mpc_parser_t *leaves[MPC_DFA_LEAVES_MAX];
+  mpc_dfa_walk_t w;
+  mpc_dfa_t *d;
+  
+  if (!mpc_dfa_supported(p, 0, leaves, &leaves_num)) { return NULL; }
+  
+  /* Bytes which every character parser treats alike share a class */
+  
+  d = calloc(1, sizeof(mpc_dfa_t));
+  d->root = p;
+  
+  for (c = 0; c < 257; c++) {
+    for (j = 0; j < leaves_num; j++) { sigs[c][j] = (char)mpc_dfa_match(leaves[j], c); }
+    for (k = 0; k < d->classes_num; k++) {
+      if (memcmp(sigs[reps[k]], sigs[c], leaves_num) == 0) { break; }
+    }
+    if (k == d->classes_num) { reps[d->classes_num++] = c; }
+    d->classes[c] = (unsigned char)k;
+  }
+  
+  /* Explore every state reachable from the start */
+  
+  w.root = p;
+  w.i = NULL;
+  w.e = NULL;
+  w.depth = 0;
+  mpc_dfa_state_find(d, &w);
+  
+  for (s = 0; s < d->states_num; s++) {
+    
+    d->trans = realloc(d->trans, sizeof(short) * d->classes_num * (s+1));
+    d->catches = realloc(d->catches, d->classes_num * (s+1));
+    
+    for (k = 0; k < d->classes_num; k++) {
+      w.c = reps[k];
+      w.catches = 0;
+      w.depth = d->states[s].depth;
+      memcpy(w.path, d->states[s].path, sizeof(mpc_dfa_step_t) * w.depth);
+      
+      r = mpc_dfa_step(&w);
+      if (r == MPC_DFA_LEAF) {
+        r = mpc_dfa_state_find(d, &w);
+        if (r == -1) { mpc_dfa_delete(d); return NULL; }
+      }
+      
+      d->trans[s * d->classes_num + k] = (short)r;
+      d->catches[s * d->classes_num + k] = (char)w.catches;
+    }
+  }
+  
+  return d;
+}
+
+static void mpc_dfa_advance(mpc_input_t *i, long pos) {
+  while (i->state.pos < pos) {
+    i->last = i->string[i->state.pos++];
+    i->state.col++;
+    if (i->last == '\n') {
+      i->state.col = 0;
+      i->state.row++;
+    }
+  }
+}
+
+/*
+** Replay the step from state `s` at `pos` with
+** the input, leaving its errors behind as the
+** combinators would, and return the error the
+** step fails with if it does.
+*/
+
+static mpc_err_t *mpc_dfa_replay(mpc_input_t *i, mpc_dfa_t *d, int s, long pos, mpc_err_t **e) {
+  
+  int j;
+  mpc_dfa_walk_t w;
+  mpc_state_t state = i->state;
+  char last = i->last;
+  
+  mpc_dfa_advance(i, pos);
+  
+  w.root = d->root;
+  w.i = i;
+  w.e = e;
+  w.err = NULL;
+  w.c = pos < i->length ? (unsigned char)i->string[pos] : 256;
+  w.depth = d->states[s].depth;
+  memcpy(w.path, d->states[s].path, sizeof(mpc_dfa_step_t) * w.depth);
+  
+  for (j = 0; j < w.depth-1; j++) {
+    if (w.path[j].x->type == MPC_TYPE_EXPECT) { mpc_input_suppress_enable(i); }
+  }
+  
+  mpc_dfa_step(&w);
+  
+  i->suppress = 0;
+  i->state = state;
+  i->last = last;
+  return w.err;
+}
+
+/*
+** Without a string to run over, or where the table
+** gives up, the combinators are run instead.
+*/
+
+static int mpc_parse_dfa(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
+  
+  mpc_dfa_t *d = p->data.dfa.d;
+  const unsigned char *str = (const unsigned char*)i->string;
+  long start = i->state.pos;
+  long pos = start;
+  long caught = -1;
+  int s = 0, t, c, j;
+  int caught_s = 0;
+  char *out;
+  
+  if (i->type != MPC_INPUT_STRING) { return MPC_PARSE_DEFER; }
+  
+  while (1) {
+    c = d->classes[pos < i->length ? str[pos] : 256];
+    t = d->trans[s * d->classes_num + c];
+    if (d->catches[s * d->classes_num + c]) {
+      caught = pos;
+      caught_s = s;
+    }
+    if (t < 0) { break; }
+    s = t;
+    pos++;
+  }
+  
+  /* Without backtracking the combinators would not rewind */
+  
+  if (t == MPC_DFA_BACKTRACK || (t == MPC_DFA_FAIL && i->backtrack < 1)) {
+    return MPC_PARSE_DEFER;
+  }
+  
+  if (t == MPC_DFA_FAIL) {
+    r->error = i->suppress ? NULL : mpc_dfa_replay(i, d, s, pos, e);
+    return 0;
+  }
+  
+  if (caught >= 0 && !i->suppress) {
+    mpc_dfa_replay(i, d, caught_s, caught, e);
+  }
+  
+  out = mpc_malloc(i, pos - start + 1);
+  for (j = 0; start < pos; start++) {
+    if (str[start]) { out[j++] = (char)str[start]; }
+  }
+  out[j] = '\0';
+  
+  mpc_dfa_advance(i, pos);
+  r->output = out;
+  return 1;
+}
+
+static mpc_parser_t *mpc_re_dfa(mpc_parser_t *a) {
+  mpc_parser_t *p;
+  mpc_dfa_t *d = mpc_dfa_new(a);
+  if (d == NULL) { return a; }
+  p = mpc_undefined();
+  p->type = MPC_TYPE_DFA;
+  p->data.dfa.x = a;
+  p->data.dfa.d = d;
+  return p;
+}
+
+mpc_parser_t *mpc_re(const char *re) {
+  
+  char *err_msg;
+  mpc_parser_t *err_out;
+  mpc_result_t r;
+  mpc_parser_t *Regex, *Term, *Factor, *Base, *Range, *RegexEnclose; 
+  
+  Regex  = mpc_new("regex");
+  Term   = mpc_new("term");
+  Factor = mpc_new("factor");
+  Base   = mpc_new("base");
+  Range  = mpc_new("range");
+  
+  mpc_define(Regex, mpc_and(2, mpcf_re_or,
+    Term, 
+    mpc_maybe(mpc_and(2, mpcf_snd_free, mpc_char('|'), Regex, free)),
+    (mpc_dtor_t)mpc_delete
+  ));
+  
+  mpc_define(Term, mpc_many(mpcf_re_and, Factor));
+  
+  mpc_define(Factor, mpc_and(2, mpcf_re_repeat,
+    Base,
+    mpc_or(5,
+      mpc_char('*'), mpc_char('+'), mpc_char('?'),
+      mpc_brackets(mpc_int(), free),
+      mpc_pass()),
+    (mpc_dtor_t)mpc_delete
+  ));
+  
+  mpc_define(Base, mpc_or(4,
+    mpc_parens(Regex, (mpc_dtor_t)mpc_delete),
+    mpc_squares(Range, (mpc_dtor_t)mpc_delete),
+    mpc_apply(mpc_escape(), mpcf_re_escape),
     mpc_apply(mpc_noneof(")|"), mpcf_re_escape)
   ));
   
@@ -2180,10 +3131,329 @@ mpc_parser_t *mpc_re(const char *re) {
   
   mpc_optimise(r.output);
   
-  return r.output;
+  return mpc_re_dfa(r.output);
+  
+}
+
+/*
+** Alternative Dispatch
+*/
+
+/*
+** An `or` tries each of its alternatives in turn
+** until one matches, and most of them fail on the
+** very first character. The FIRST set of a parser
+** is the set of characters it can start with, and
+** if it can't match without consuming any input,
+** a character outside that set means it is sure
+** to fail without moving. `mpc_optimise` works out
+** the FIRST set of every alternative and groups the
+** characters into classes which leave the same ones
+** standing, so on a string input the `or` goes
+** straight to those.
+**
+** The skipped alternatives still add what they
+** expected to the error. Those failures happen at
+** the start, so they don't depend on the input
+** beyond the next character, and are found once
+** up front by running each skipped alternative on
+** a single character from its class. Parsers which
+** depend on more than the next character, such as
+** anchors and `not`, are always run.
+**
+** The FIRST sets follow references into retained
+** parsers, so any `or` built from them should be
+** optimised again if they are redefined.
+*/
+
+enum {
+  MPC_FIRST_DEPTH_MAX = 128
+};
+
+typedef struct {
+  unsigned char first[32];
+  char nullable;
+  char opaque;
+} mpc_first_t;
+
+typedef struct {
+  int x;
+  int expected_num;
+  char **expected;
+} mpc_dispatch_step_t;
+
+struct mpc_dispatch_t {
+  int ll1;
+  int classes_num;
+  unsigned char classes[257];
+  int *offsets;
+  mpc_dispatch_step_t *steps;
+};
+
+static int mpc_first_has(mpc_first_t *f, int c) {
+  return f->opaque || f->nullable || (c < 256 && (f->first[c / 8] & (1 << (c % 8))));
+}
+
+static void mpc_first(mpc_parser_t *p, mpc_first_t *f, mpc_parser_t **stk, int depth) {
+  
+  int j, c;
+  mpc_first_t g;
+  
+  memset(f, 0, sizeof(mpc_first_t));
+  
+  for (j = 0; p->retained && j < depth; j++) {
+    if (stk[j] == p) { f->opaque = 1; return; }
+  }
+  
+  if (depth == MPC_FIRST_DEPTH_MAX) { f->opaque = 1; return; }
+  stk[depth] = p;
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SINGLE:
+    case MPC_TYPE_RANGE:
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_SATISFY:
+      for (c = 0; c < 256; c++) {
+        if (p->type == MPC_TYPE_SATISFY ? p->data.satisfy.f((char)c) : mpc_dfa_match(p, c)) {
+          f->first[c / 8] |= 1 << (c % 8);
+        }
+      }
+      break;
+    
+    case MPC_TYPE_STRING:
+      c = (unsigned char)p->data.string.x[0];
+      if (c) { f->first[c / 8] |= 1 << (c % 8); } else { f->nullable = 1; }
+      break;
+    
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_LIFT:
+    case MPC_TYPE_LIFT_VAL:
+    case MPC_TYPE_STATE:
+      f->nullable = 1;
+      break;
+    
+    case MPC_TYPE_EXPECT:   mpc_first(p->data.expect.x, f, stk, depth+1);   break;
+    case MPC_TYPE_APPLY:    mpc_first(p->data.apply.x, f, stk, depth+1);    break;
+    case MPC_TYPE_APPLY_TO: mpc_first(p->data.apply_to.x, f, stk, depth+1); break;
+    case MPC_TYPE_PREDICT:  mpc_first(p->data.predict.x, f, stk, depth+1);  break;
+    case MPC_TYPE_DFA:      mpc_first(p->data.dfa.x, f, stk, depth+1);      break;
+    case MPC_TYPE_MEMO:     mpc_first(p->data.memo.x, f, stk, depth+1);     break;
+    case MPC_TYPE_ARENA:    mpc_first(p->data.arena.x, f, stk, depth+1);    break;
+    
+    case MPC_TYPE_MAYBE:
+      mpc_first(p->data.not.x, f, stk, depth+1);
+      f->nullable = 1;
+      break;
+    
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      mpc_first(p->data.repeat.x, f, stk, depth+1);
+      if (p->type != MPC_TYPE_COUNT && f->nullable) { f->opaque = 1; }
+      if (p->type == MPC_TYPE_COUNT && p->data.repeat.n < 1) { f->opaque = 1; }
+      if (p->type == MPC_TYPE_MANY) { f->nullable = 1; }
+      break;
+    
+    case MPC_TYPE_OR:
+      f->nullable = p->data.or.n == 0;
+      for (j = 0; j < p->data.or.n; j++) {
+        mpc_first(p->data.or.xs[j], &g, stk, depth+1);
+        for (c = 0; c < 32; c++) { f->first[c] |= g.first[c]; }
+        f->nullable |= g.nullable;
+        f->opaque |= g.opaque;
+      }
+      break;
+    
+    case MPC_TYPE_AND:
+      f->nullable = 1;
+      for (j = 0; j < p->data.and.n && f->nullable; j++) {
+        mpc_first(p->data.and.xs[j], &g, stk, depth+1);
+        for (c = 0; c < 32; c++) { f->first[c] |= g.first[c]; }
+        f->nullable = g.nullable;
+        f->opaque |= g.opaque;
+      }
+      break;
+    
+    default:
+      f->opaque = 1;
+      break;
+  }
   
 }
 
+static void mpc_dispatch_delete(mpc_dispatch_t *d) {
+  int j, k;
+  if (d == NULL) { return; }
+  for (j = 0; j < d->offsets[d->classes_num]; j++) {
+    for (k = 0; k < d->steps[j].expected_num; k++) { free(d->steps[j].expected[k]); }
+    free(d->steps[j].expected);
+  }
+  free(d->offsets);
+  free(d->steps);
+  free(d);
+}
+
+static int mpc_dispatch_skip(mpc_input_t *i, mpc_parser_t *x, mpc_err_t **e) {
+  mpc_result_t r;
+  if (mpc_parse_run(i, x, &r, e) || i->state.pos != 0) { return 0; }
+  *e = mpc_err_merge(i, *e, r.error);
+  return *e == NULL || (*e)->failure == NULL;
+}
+
+static void mpc_dispatch_flush(mpc_input_t *i, mpc_dispatch_t *d, int *steps_slots, mpc_err_t **e) {
+  
+  mpc_dispatch_step_t *s;
+  int k;
+  
+  if (*e == NULL) { return; }
+  if ((*e)->expected_num == 0) { mpc_err_delete_internal(i, *e); *e = NULL; return; }
+  
+  if (d->offsets[d->classes_num] == *steps_slots) {
+    *steps_slots *= 2;
+    d->steps = realloc(d->steps, sizeof(mpc_dispatch_step_t) * *steps_slots);
+  }
+  
+  s = &d->steps[d->offsets[d->classes_num]++];
+  s->x = -1;
+  s->expected_num = (*e)->expected_num;
+  s->expected = malloc(sizeof(char*) * s->expected_num);
+  for (k = 0; k < s->expected_num; k++) {
+    s->expected[k] = malloc(strlen((*e)->expected[k]) + 1);
+    strcpy(s->expected[k], (*e)->expected[k]);
+  }
+  
+  mpc_err_delete_internal(i, *e);
+  *e = NULL;
+}
+
+static mpc_dispatch_t *mpc_dispatch_new(mpc_parser_t *p) {
+  
+  int n = p->data.or.n;
+  int c, j, k, viable, skipped, steps_slots;
+  int reps[257];
+  char rep[1];
+  mpc_first_t *fs;
+  mpc_parser_t *stk[MPC_FIRST_DEPTH_MAX];
+  mpc_dispatch_t *d;
+  mpc_input_t *i;
+  mpc_err_t *e;
+  
+  if (n == 0) { return NULL; }
+  
+  fs = malloc(sizeof(mpc_first_t) * n);
+  stk[0] = p;
+  for (j = 0; j < n; j++) { mpc_first(p->data.or.xs[j], &fs[j], stk, 1); }
+  
+  d = calloc(1, sizeof(mpc_dispatch_t));
+  d->ll1 = 1;
+  skipped = 0;
+  
+  for (c = 0; c <= 256; c++) {
+    
+    for (viable = 0, j = 0; j < n; j++) { viable += mpc_first_has(&fs[j], c); }
+    skipped += n - viable;
+    if (viable > 1) { d->ll1 = 0; }
+    
+    for (k = 0; k < d->classes_num; k++) {
+      for (j = 0; j < n; j++) {
+        if (mpc_first_has(&fs[j], c) != mpc_first_has(&fs[j], reps[k])) { break; }
+      }
+      if (j == n) { break; }
+    }
+    
+    if (k == d->classes_num) { reps[d->classes_num++] = c; }
+    d->classes[c] = k;
+  }
+  
+  if (skipped == 0) {
+    free(fs);
+    free(d);
+    return NULL;
+  }
+  
+  /* Run the skipped alternatives once on a character from each class */
+  
+  steps_slots = n + 1;
+  d->offsets = calloc(d->classes_num + 1, sizeof(int));
+  d->steps = malloc(sizeof(mpc_dispatch_step_t) * steps_slots);
+  i = mpc_input_new_nstring("<mpc_dispatch>", "", 0);
+  e = NULL;
+  
+  for (k = 0; k < d->classes_num; k++) {
+    
+    rep[0] = (char)reps[k];
+    mpc_input_reset_nstring(i, "<mpc_dispatch>", rep, reps[k] == 256 ? 0 : 1);
+    d->offsets[k] = d->offsets[d->classes_num];
+    
+    for (j = 0; j < n; j++) {
+      
+      if (!mpc_first_has(&fs[j], reps[k])) {
+        if (mpc_dispatch_skip(i, p->data.or.xs[j], &e)) { continue; }
+        mpc_err_delete_internal(i, e);
+        mpc_input_delete(i);
+        mpc_dispatch_delete(d);
+        free(fs);
+        return NULL;
+      }
+      
+      mpc_dispatch_flush(i, d, &steps_slots, &e);
+      if (d->offsets[d->classes_num] == steps_slots) {
+        steps_slots *= 2;
+        d->steps = realloc(d->steps, sizeof(mpc_dispatch_step_t) * steps_slots);
+      }
+      d->steps[d->offsets[d->classes_num]].x = j;
+      d->steps[d->offsets[d->classes_num]].expected_num = 0;
+      d->steps[d->offsets[d->classes_num]].expected = NULL;
+      d->offsets[d->classes_num]++;
+    }
+    
+    mpc_dispatch_flush(i, d, &steps_slots, &e);
+  }
+  
+  mpc_input_delete(i);
+  free(fs);
+  return d;
+}
+
+/*
+** Give the next alternative to try on the character
+** at `pos`, noting what was expected of any skipped
+** on the way, or -1 when there are no more. Step `k`
+** counts from the first for that character.
+*/
+
+static int mpc_dispatch_next(mpc_input_t *i, mpc_parser_t *p, long pos, int *k, mpc_err_t **e) {
+  
+  mpc_dispatch_t *d = p->data.or.d;
+  mpc_dispatch_step_t *s, *end;
+  mpc_err_t *x;
+  int c, j;
+  
+  c = pos < i->length ? (unsigned char)i->string[pos] : 256;
+  s = d->steps + d->offsets[d->classes[c]] + *k;
+  end = d->steps + d->offsets[d->classes[c] + 1];
+  
+  for (; s < end; s++, (*k)++) {
+    
+    if (s->x >= 0) { return s->x; }
+    
+    /* An error further along would hide this one anyway */
+    
+    if (i->suppress || (*e && (*e)->state.pos > i->state.pos)) { continue; }
+    
+    x = mpc_err_new(i, s->expected[0]);
+    for (j = 1; j < s->expected_num; j++) {
+      mpc_err_add_expected(i, x, s->expected[j]);
+    }
+    *e = mpc_err_merge(i, *e, x);
+  }
+  
+  return -1;
+}
+
 /*
 ** Common Fold Functions
 */
@@ -2521,6 +3791,9 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { mpc_print_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { mpc_print_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { mpc_print_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_DFA)      { mpc_print_unretained(p->data.dfa.x, 0); }
+  if (p->type == MPC_TYPE_MEMO)     { mpc_print_unretained(p->data.memo.x, 0); }
+  if (p->type == MPC_TYPE_ARENA)    { mpc_print_unretained(p->data.arena.x, 0); }
 
   if (p->type == MPC_TYPE_NOT)   { mpc_print_unretained(p->data.not.x, 0); printf("!"); }
   if (p->type == MPC_TYPE_MAYBE) { mpc_print_unretained(p->data.not.x, 0); printf("?"); }
@@ -2537,6 +3810,7 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
     }
     mpc_print_unretained(p->data.or.xs[p->data.or.n-1], 0);
     printf(")");
+    if (p->data.or.d) { printf(p->data.or.d->ll1 ? "{LL(1)}" : "{FIRST}"); }
   }
   
   if (p->type == MPC_TYPE_AND) {
@@ -2632,6 +3906,11 @@ void mpc_ast_delete(mpc_ast_t *a) {
   
   if (a == NULL) { return; }
   
+  if (a->arena) {
+    mpc_arena_ast_delete(a->arena, a);
+    return;
+  }
+  
   for (i = 0; i < a->children_num; i++) {
     mpc_ast_delete(a->children[i]);
   }
@@ -2644,6 +3923,7 @@ void mpc_ast_delete(mpc_ast_t *a) {
 }
 
 static void mpc_ast_delete_no_children(mpc_ast_t *a) {
+  if (a->arena) { return; }
   free(a->children);
   free(a->tag);
   free(a->contents);
@@ -2664,6 +3944,7 @@ mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
   
   a->children_num = 0;
   a->children = NULL;
+  a->arena = NULL;
   return a;
   
 }
@@ -2715,6 +3996,19 @@ int mpc_ast_eq(mpc_ast_t *a, mpc_ast_t *b) {
 }
 
 mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a) {
+  
+  mpc_ast_t **cs;
+  
+  /* Child lists in an arena can't grow in place */
+  
+  if (r->arena) {
+    cs = mpc_arena_alloc(r->arena, sizeof(mpc_ast_t*) * (r->children_num + 1));
+    if (r->children_num) { memcpy(cs, r->children, sizeof(mpc_ast_t*) * r->children_num); }
+    cs[r->children_num++] = mpc_arena_adopt(r->arena, a);
+    r->children = cs;
+    return r;
+  }
+  
   r->children_num++;
   r->children = realloc(r->children, sizeof(mpc_ast_t*) * r->children_num);
   r->children[r->children_num-1] = a;
@@ -2723,6 +4017,7 @@ mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a) {
 
 mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t) {
   if (a == NULL) { return a; }
+  if (a->arena) { a->tag = mpc_arena_join(a->arena, t, a->tag); return a; }
   a->tag = realloc(a->tag, strlen(t) + 1 + strlen(a->tag) + 1);
   memmove(a->tag + strlen(t) + 1, a->tag, strlen(a->tag)+1);
   memmove(a->tag, t, strlen(t));
@@ -2730,88 +4025,491 @@ mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t) {
   return a;
 }
 
-mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t) {
-  a->tag = realloc(a->tag, strlen(t) + 1);
-  strcpy(a->tag, t);
-  return a;
+mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t) {
+  if (a->arena) { a->tag = mpc_arena_intern(a->arena, t); return a; }
+  a->tag = realloc(a->tag, strlen(t) + 1);
+  strcpy(a->tag, t);
+  return a;
+}
+
+mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s) {
+  if (a == NULL) { return a; }
+  a->state = s;
+  return a;
+}
+
+static void mpc_ast_print_depth(mpc_ast_t *a, int d, FILE *fp) {
+  
+  int i;
+  
+  if (a == NULL) {
+    fprintf(fp, "NULL\n");
+    return;
+  }
+  
+  for (i = 0; i < d; i++) { fprintf(fp, "  "); }
+  
+  if (strlen(a->contents)) {
+    fprintf(fp, "%s:%lu:%lu '%s'\n", a->tag, 
+      (long unsigned int)(a->state.row+1),
+      (long unsigned int)(a->state.col+1),
+      a->contents);
+  } else {
+    fprintf(fp, "%s \n", a->tag);
+  }
+  
+  for (i = 0; i < a->children_num; i++) {
+    mpc_ast_print_depth(a->children[i], d+1, fp);
+  }
+  
+}
+
+void mpc_ast_print(mpc_ast_t *a) {
+  mpc_ast_print_depth(a, 0, stdout);
+}
+
+void mpc_ast_print_to(mpc_ast_t *a, FILE *fp) {
+  mpc_ast_print_depth(a, 0, fp);
+}
+
+int mpc_ast_get_index(mpc_ast_t *ast, const char *tag) {
+  return mpc_ast_get_index_lb(ast, tag, 0);
+}
+
+int mpc_ast_get_index_lb(mpc_ast_t *ast, const char *tag, int lb) {
+  int i;
+
+  for(i=lb; i<ast->children_num; i++) {
+    if(strcmp(ast->children[i]->tag, tag) == 0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+mpc_ast_t *mpc_ast_get_child(mpc_ast_t *ast, const char *tag) {
+  return mpc_ast_get_child_lb(ast, tag, 0);
+}
+
+mpc_ast_t *mpc_ast_get_child_lb(mpc_ast_t *ast, const char *tag, int lb) {
+  int i;
+
+  for(i=lb; i<ast->children_num; i++) {
+    if(strcmp(ast->children[i]->tag, tag) == 0) {
+      return ast->children[i];
+    }
+  }
+
+  return NULL;
+}
+
+mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
+  
+  int i, j;
+  mpc_ast_t** as = (mpc_ast_t**)xs;
+  mpc_ast_t *r;
+  
+  if (n == 0) { return NULL; }
+  if (n == 1) { return xs[0]; }
+  if (n == 2 && xs[1] == NULL) { return xs[0]; }
+  if (n == 2 && xs[0] == NULL) { return xs[1]; }
+  
+  r = mpc_ast_new(">", "");
+  
+  for (i = 0; i < n; i++) {
+    
+    if (as[i] == NULL) { continue; }
+    
+    if (as[i] && as[i]->children_num > 0) {
+      
+      for (j = 0; j < as[i]->children_num; j++) {
+        mpc_ast_add_child(r, as[i]->children[j]);
+      }
+      
+      mpc_ast_delete_no_children(as[i]);
+      
+    } else if (as[i] && as[i]->children_num == 0) {
+      mpc_ast_add_child(r, as[i]);
+    }
+  
+  }
+  
+  if (r->children_num) {
+    r->state = r->children[0]->state;
+  }
+  
+  return r;
+}
+
+mpc_val_t *mpcf_str_ast(mpc_val_t *c) {
+  mpc_ast_t *a = mpc_ast_new("", c);
+  free(c);
+  return a;
+}
+
+mpc_val_t *mpcf_state_ast(int n, mpc_val_t **xs) {
+  mpc_state_t *s = ((mpc_state_t**)xs)[0];
+  mpc_ast_t *a = ((mpc_ast_t**)xs)[1];
+  (void)n;
+  a = mpc_ast_state(a, *s);
+  free(s);
+  return a;
+}
+
+mpc_parser_t *mpca_state(mpc_parser_t *a) {
+  return mpc_and(2, mpcf_state_ast, mpc_state(), a, free);
+}
+
+mpc_parser_t *mpca_tag(mpc_parser_t *a, const char *t) {
+  return mpc_apply_to(a, (mpc_apply_to_t)mpc_ast_tag, (void*)t);
+}
+
+mpc_parser_t *mpca_add_tag(mpc_parser_t *a, const char *t) {
+  return mpc_apply_to(a, (mpc_apply_to_t)mpc_ast_add_tag, (void*)t);
+}
+
+mpc_parser_t *mpca_root(mpc_parser_t *a) {
+  return mpc_apply(a, (mpc_apply_t)mpc_ast_add_root);
+}
+
+mpc_parser_t *mpca_not(mpc_parser_t *a) { return mpc_not(a, (mpc_dtor_t)mpc_ast_delete); }
+mpc_parser_t *mpca_maybe(mpc_parser_t *a) { return mpc_maybe(a); }
+mpc_parser_t *mpca_many(mpc_parser_t *a) { return mpc_many(mpcf_fold_ast, a); }
+mpc_parser_t *mpca_many1(mpc_parser_t *a) { return mpc_many1(mpcf_fold_ast, a); }
+mpc_parser_t *mpca_count(int n, mpc_parser_t *a) { return mpc_count(n, mpcf_fold_ast, a, (mpc_dtor_t)mpc_ast_delete); }
+
+mpc_parser_t *mpca_or(int n, ...) {
+
+  int i;
+  va_list va;
+
+  mpc_parser_t *p = mpc_undefined();
+  
+  p->type = MPC_TYPE_OR;
+  p->data.or.n = n;
+  p->data.or.xs = malloc(sizeof(mpc_parser_t*) * n);
+  
+  va_start(va, n);  
+  for (i = 0; i < n; i++) {
+    p->data.or.xs[i] = va_arg(va, mpc_parser_t*);
+  }
+  va_end(va);
+  
+  return p;
+  
+}
+
+mpc_parser_t *mpca_and(int n, ...) {
+  
+  int i;
+  va_list va;
+  
+  mpc_parser_t *p = mpc_undefined();
+  
+  p->type = MPC_TYPE_AND;
+  p->data.and.n = n;
+  p->data.and.f = mpcf_fold_ast;
+  p->data.and.xs = malloc(sizeof(mpc_parser_t*) * n);
+  p->data.and.dxs = malloc(sizeof(mpc_dtor_t) * (n-1));
+  
+  va_start(va, n);
+  for (i = 0; i < n; i++) {
+    p->data.and.xs[i] = va_arg(va, mpc_parser_t*);
+  }
+  for (i = 0; i < (n-1); i++) {
+    p->data.and.dxs[i] = (mpc_dtor_t)mpc_ast_delete;
+  }    
+  va_end(va);
+  
+  return p;  
+}
+
+mpc_parser_t *mpca_total(mpc_parser_t *a) { return mpc_total(a, (mpc_dtor_t)mpc_ast_delete); }
+
+/*
+** AST Arena
+*/
+
+/*
+** `mpca_arena` makes the tree a rule parses live in
+** an arena. Nodes, their contents and their lists of
+** children are carved out of a few large blocks rather
+** than each allocated on its own, and tags are interned,
+** so a tag points at the one copy of that string and
+** tagging a node copies nothing. Deleting the root
+** frees every block at once, and deleting any other
+** node of the tree does nothing.
+**
+** Only the rule a parse starts from owns an arena. A
+** node made the usual way that ends up in the tree, say
+** by a parser the grammar refers to, is adopted by the
+** arena and deleted along with it.
+*/
+
+enum {
+  MPC_ARENA_BLOCK_MIN = 4096,
+  MPC_ARENA_BLOCK_MAX = 1048576,
+  MPC_ARENA_TAGS_MIN  = 64,
+  MPC_ARENA_JOIN_MAX  = 128
+};
+
+typedef union mpc_block_t {
+  union mpc_block_t *next;
+  long l;
+  double d;
+} mpc_block_t;
+
+typedef struct {
+  const char *t;
+  const char *tag;
+  char *id;
+} mpc_arena_pair_t;
+
+struct mpc_arena_t {
+  
+  mpc_block_t *blocks;
+  char *next;
+  size_t left;
+  size_t block_size;
+  
+  mpc_ast_t *root;
+  char *empty;
+  
+  int tags_num;
+  int tags_slots;
+  char **tags;
+  
+  int pairs_num;
+  int pairs_slots;
+  mpc_arena_pair_t *pairs;
+  
+  int adopted_num;
+  int adopted_slots;
+  mpc_ast_t **adopted;
+  
+};
+
+static mpc_arena_t *mpc_arena_new(void) {
+  
+  mpc_arena_t *m = malloc(sizeof(mpc_arena_t));
+  
+  m->blocks = NULL;
+  m->next = NULL;
+  m->left = 0;
+  m->block_size = MPC_ARENA_BLOCK_MIN;
+  
+  m->root = NULL;
+  
+  m->tags_num = 0;
+  m->tags_slots = MPC_ARENA_TAGS_MIN;
+  m->tags = calloc(m->tags_slots, sizeof(char*));
+  
+  m->pairs_num = 0;
+  m->pairs_slots = MPC_ARENA_TAGS_MIN;
+  m->pairs = calloc(m->pairs_slots, sizeof(mpc_arena_pair_t));
+  
+  m->adopted_num = 0;
+  m->adopted_slots = 0;
+  m->adopted = NULL;
+  
+  m->empty = mpc_arena_intern(m, "");
+  
+  return m;
+}
+
+static void mpc_arena_delete(mpc_arena_t *m) {
+  
+  int j;
+  mpc_block_t *b;
+  
+  m->root = NULL;
+  for (j = 0; j < m->adopted_num; j++) { mpc_ast_delete(m->adopted[j]); }
+  
+  while (m->blocks) {
+    b = m->blocks;
+    m->blocks = b->next;
+    free(b);
+  }
+  
+  free(m->tags);
+  free(m->pairs);
+  free(m->adopted);
+  free(m);
+}
+
+static void mpc_arena_ast_delete(mpc_arena_t *m, mpc_ast_t *a) {
+  if (m->root == a) { mpc_arena_delete(m); }
+}
+
+static void *mpc_arena_alloc(mpc_arena_t *m, size_t n) {
+  
+  mpc_block_t *b;
+  size_t size;
+  char *p;
+  
+  n = (n + sizeof(mpc_block_t) - 1) / sizeof(mpc_block_t) * sizeof(mpc_block_t);
+  
+  if (m->left < n) {
+    size = n > m->block_size ? n : m->block_size;
+    if (m->block_size < MPC_ARENA_BLOCK_MAX) { m->block_size *= 2; }
+    b = malloc(sizeof(mpc_block_t) + size);
+    b->next = m->blocks;
+    m->blocks = b;
+    m->next = (char*)(b + 1);
+    m->left = size;
+  }
+  
+  p = m->next;
+  m->next += n;
+  m->left -= n;
+  return p;
+}
+
+static char *mpc_arena_str(mpc_arena_t *m, const char *s) {
+  size_t n = strlen(s);
+  char *c;
+  if (n == 0) { return m->empty; }
+  c = mpc_arena_alloc(m, n + 1);
+  memcpy(c, s, n + 1);
+  return c;
 }
 
-mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s) {
-  if (a == NULL) { return a; }
-  a->state = s;
-  return a;
+static unsigned long mpc_arena_hash(const char *t) {
+  unsigned long h = 5381;
+  while (*t) { h = h * 33 + (unsigned char)*t++; }
+  return h;
 }
 
-static void mpc_ast_print_depth(mpc_ast_t *a, int d, FILE *fp) {
-  
-  int i;
-  
-  if (a == NULL) {
-    fprintf(fp, "NULL\n");
-    return;
-  }
+static char *mpc_arena_intern(mpc_arena_t *m, const char *t) {
   
-  for (i = 0; i < d; i++) { fprintf(fp, "  "); }
+  int j, k, slots;
+  char **tags;
   
-  if (strlen(a->contents)) {
-    fprintf(fp, "%s:%lu:%lu '%s'\n", a->tag, 
-      (long unsigned int)(a->state.row+1),
-      (long unsigned int)(a->state.col+1),
-      a->contents);
-  } else {
-    fprintf(fp, "%s \n", a->tag);
+  if (m->tags_num * 2 >= m->tags_slots) {
+    slots = m->tags_slots;
+    tags = m->tags;
+    m->tags_slots *= 2;
+    m->tags = calloc(m->tags_slots, sizeof(char*));
+    for (j = 0; j < slots; j++) {
+      if (tags[j] == NULL) { continue; }
+      k = (int)(mpc_arena_hash(tags[j]) & (unsigned long)(m->tags_slots - 1));
+      while (m->tags[k]) { k = (k + 1) & (m->tags_slots - 1); }
+      m->tags[k] = tags[j];
+    }
+    free(tags);
   }
   
-  for (i = 0; i < a->children_num; i++) {
-    mpc_ast_print_depth(a->children[i], d+1, fp);
+  j = (int)(mpc_arena_hash(t) & (unsigned long)(m->tags_slots - 1));
+  while (m->tags[j]) {
+    if (strcmp(m->tags[j], t) == 0) { return m->tags[j]; }
+    j = (j + 1) & (m->tags_slots - 1);
   }
   
+  m->tags[j] = mpc_arena_alloc(m, strlen(t) + 1);
+  strcpy(m->tags[j], t);
+  m->tags_num++;
+  return m->tags[j];
 }
 
-void mpc_ast_print(mpc_ast_t *a) {
-  mpc_ast_print_depth(a, 0, stdout);
+static char *mpc_arena_join(mpc_arena_t *m, const char *t, const char *tag) {
+  
+  char buf[MPC_ARENA_JOIN_MAX];
+  size_t n = strlen(t);
+  size_t l = strlen(tag);
+  char *s = n + l + 2 > MPC_ARENA_JOIN_MAX ? malloc(n + l + 2) : buf;
+  char *id;
+  
+  memcpy(s, t, n);
+  s[n] = '|';
+  memcpy(s + n + 1, tag, l + 1);
+  
+  id = mpc_arena_intern(m, s);
+  if (s != buf) { free(s); }
+  return id;
 }
 
-void mpc_ast_print_to(mpc_ast_t *a, FILE *fp) {
-  mpc_ast_print_depth(a, 0, fp);
-}
+/*
+** While parsing, the tags added come from the grammar
+** and the tags added to are interned, so what each
+** makes of each is kept by pointer and tagging a node
+** is one lookup, with `tag` NULL for a plain tag.
+*/
 
-int mpc_ast_get_index(mpc_ast_t *ast, const char *tag) {
-  return mpc_ast_get_index_lb(ast, tag, 0);
+static int mpc_arena_pair_slot(mpc_arena_t *m, const char *t, const char *tag) {
+  unsigned long h = ((unsigned long)(size_t)t >> 3) * 31 + ((unsigned long)(size_t)tag >> 3);
+  return (int)(h & (unsigned long)(m->pairs_slots - 1));
 }
 
-int mpc_ast_get_index_lb(mpc_ast_t *ast, const char *tag, int lb) {
-  int i;
-
-  for(i=lb; i<ast->children_num; i++) {
-    if(strcmp(ast->children[i]->tag, tag) == 0) {
-      return i;
+static char *mpc_arena_pair(mpc_arena_t *m, const char *t, const char *tag) {
+  
+  int j, k, slots;
+  mpc_arena_pair_t *pairs, *q;
+  
+  if (m->pairs_num * 2 >= m->pairs_slots) {
+    slots = m->pairs_slots;
+    pairs = m->pairs;
+    m->pairs_slots *= 2;
+    m->pairs = calloc(m->pairs_slots, sizeof(mpc_arena_pair_t));
+    for (j = 0; j < slots; j++) {
+      if (pairs[j].t == NULL) { continue; }
+      k = mpc_arena_pair_slot(m, pairs[j].t, pairs[j].tag);
+      while (m->pairs[k].t) { k = (k + 1) & (m->pairs_slots - 1); }
+      m->pairs[k] = pairs[j];
     }
+    free(pairs);
   }
-
-  return -1;
+  
+  j = mpc_arena_pair_slot(m, t, tag);
+  while (m->pairs[j].t) {
+    if (m->pairs[j].t == t && m->pairs[j].tag == tag) { return m->pairs[j].id; }
+    j = (j + 1) & (m->pairs_slots - 1);
+  }
+  
+  q = &m->pairs[j];
+  q->t = t;
+  q->tag = tag;
+  q->id = tag ? mpc_arena_join(m, t, tag) : mpc_arena_intern(m, t);
+  m->pairs_num++;
+  return q->id;
 }
 
-mpc_ast_t *mpc_ast_get_child(mpc_ast_t *ast, const char *tag) {
-  return mpc_ast_get_child_lb(ast, tag, 0);
+static mpc_ast_t *mpc_arena_adopt(mpc_arena_t *m, mpc_ast_t *a) {
+  
+  if (a == NULL || a->arena == m) { return a; }
+  
+  if (m->adopted_num == m->adopted_slots) {
+    m->adopted_slots = m->adopted_slots ? m->adopted_slots * 2 : 8;
+    m->adopted = realloc(m->adopted, sizeof(mpc_ast_t*) * m->adopted_slots);
+  }
+  
+  m->adopted[m->adopted_num++] = a;
+  return a;
 }
 
-mpc_ast_t *mpc_ast_get_child_lb(mpc_ast_t *ast, const char *tag, int lb) {
-  int i;
+/* A node and its list of `n` children are one allocation */
 
-  for(i=lb; i<ast->children_num; i++) {
-    if(strcmp(ast->children[i]->tag, tag) == 0) {
-      return ast->children[i];
-    }
-  }
+static mpc_ast_t *mpc_arena_node(mpc_arena_t *m, char *tag, char *contents, int n) {
+  
+  mpc_ast_t *a = mpc_arena_alloc(m, sizeof(mpc_ast_t) + sizeof(mpc_ast_t*) * n);
+  
+  a->tag = tag;
+  a->contents = contents;
+  a->state = mpc_state_new();
+  a->children_num = n;
+  a->children = n ? (mpc_ast_t**)(a + 1) : NULL;
+  a->arena = m;
+  return a;
+}
 
-  return NULL;
+static mpc_ast_t *mpc_arena_ast(mpc_arena_t *m, const char *tag, const char *contents) {
+  return mpc_arena_node(m, mpc_arena_pair(m, tag, NULL), mpc_arena_str(m, contents), 0);
 }
 
-mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
+static mpc_val_t *mpc_arena_fold_ast(mpc_arena_t *m, int n, mpc_val_t **xs) {
   
-  int i, j;
-  mpc_ast_t** as = (mpc_ast_t**)xs;
+  int i, j, k;
+  mpc_ast_t **as = (mpc_ast_t**)xs;
   mpc_ast_t *r;
   
   if (n == 0) { return NULL; }
@@ -2819,24 +4517,31 @@ mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
   if (n == 2 && xs[1] == NULL) { return xs[0]; }
   if (n == 2 && xs[0] == NULL) { return xs[1]; }
   
-  r = mpc_ast_new(">", "");
+  for (i = 0, k = 0; i < n; i++) {
+    if (as[i] == NULL) { continue; }
+    k += as[i]->children_num > 0 ? as[i]->children_num : 1;
+  }
   
-  for (i = 0; i < n; i++) {
+  r = mpc_arena_node(m, mpc_arena_pair(m, ">", NULL), m->empty, k);
+  
+  for (i = 0, k = 0; i < n; i++) {
     
     if (as[i] == NULL) { continue; }
     
-    if (as[i] && as[i]->children_num > 0) {
-      
+    /* Children of a node in the arena are already in the tree */
+    
+    if (as[i]->children_num > 0 && as[i]->arena == m) {
+      memcpy(r->children + k, as[i]->children, sizeof(mpc_ast_t*) * as[i]->children_num);
+      k += as[i]->children_num;
+    } else if (as[i]->children_num > 0) {
       for (j = 0; j < as[i]->children_num; j++) {
-        mpc_ast_add_child(r, as[i]->children[j]);
+        r->children[k++] = mpc_arena_adopt(m, as[i]->children[j]);
       }
-      
       mpc_ast_delete_no_children(as[i]);
-      
-    } else if (as[i] && as[i]->children_num == 0) {
-      mpc_ast_add_child(r, as[i]);
+    } else {
+      r->children[k++] = mpc_arena_adopt(m, as[i]);
     }
-  
+    
   }
   
   if (r->children_num) {
@@ -2846,90 +4551,295 @@ mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
   return r;
 }
 
-mpc_val_t *mpcf_str_ast(mpc_val_t *c) {
-  mpc_ast_t *a = mpc_ast_new("", c);
-  free(c);
-  return a;
+static mpc_ast_t *mpc_arena_add_root(mpc_arena_t *m, mpc_ast_t *a) {
+  
+  mpc_ast_t *r;
+  
+  if (a == NULL) { return a; }
+  if (a->children_num <= 1) { return a; }
+  
+  r = mpc_arena_node(m, mpc_arena_pair(m, ">", NULL), m->empty, 1);
+  r->children[0] = mpc_arena_adopt(m, a);
+  return r;
 }
 
-mpc_val_t *mpcf_state_ast(int n, mpc_val_t **xs) {
-  mpc_state_t *s = ((mpc_state_t**)xs)[0];
-  mpc_ast_t *a = ((mpc_ast_t**)xs)[1];
-  (void)n;
-  a = mpc_ast_state(a, *s);
-  free(s);
+static mpc_ast_t *mpc_arena_tag(mpc_arena_t *m, mpc_ast_t *a, const char *t) {
+  if (a == NULL || a->arena != m) { return mpc_ast_tag(a, t); }
+  a->tag = mpc_arena_pair(m, t, NULL);
   return a;
 }
 
-mpc_parser_t *mpca_state(mpc_parser_t *a) {
-  return mpc_and(2, mpcf_state_ast, mpc_state(), a, free);
+static mpc_ast_t *mpc_arena_add_tag(mpc_arena_t *m, mpc_ast_t *a, const char *t) {
+  if (a == NULL || a->arena != m) { return mpc_ast_add_tag(a, t); }
+  a->tag = mpc_arena_pair(m, t, a->tag);
+  return a;
 }
 
-mpc_parser_t *mpca_tag(mpc_parser_t *a, const char *t) {
-  return mpc_apply_to(a, (mpc_apply_to_t)mpc_ast_tag, (void*)t);
-}
+/*
+** The root is what frees the arena, so one made the
+** usual way is moved in, and an empty parse leaves
+** no arena behind.
+*/
 
-mpc_parser_t *mpca_add_tag(mpc_parser_t *a, const char *t) {
-  return mpc_apply_to(a, (mpc_apply_to_t)mpc_ast_add_tag, (void*)t);
+static mpc_ast_t *mpc_arena_finish(mpc_arena_t *m, mpc_ast_t *a) {
+  
+  int j;
+  mpc_ast_t *r;
+  
+  if (a == NULL) {
+    mpc_arena_delete(m);
+    return NULL;
+  }
+  
+  if (a->arena != m) {
+    r = mpc_arena_node(m, mpc_arena_intern(m, a->tag), mpc_arena_str(m, a->contents), a->children_num);
+    r->state = a->state;
+    for (j = 0; j < a->children_num; j++) {
+      r->children[j] = mpc_arena_adopt(m, a->children[j]);
+    }
+    mpc_ast_delete_no_children(a);
+    a = r;
+  }
+  
+  m->root = a;
+  return a;
 }
 
-mpc_parser_t *mpca_root(mpc_parser_t *a) {
-  return mpc_apply(a, (mpc_apply_t)mpc_ast_add_root);
+mpc_parser_t *mpca_arena(mpc_parser_t *a) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_ARENA;
+  p->data.arena.x = a;
+  return p;
 }
 
-mpc_parser_t *mpca_not(mpc_parser_t *a) { return mpc_not(a, (mpc_dtor_t)mpc_ast_delete); }
-mpc_parser_t *mpca_maybe(mpc_parser_t *a) { return mpc_maybe(a); }
-mpc_parser_t *mpca_many(mpc_parser_t *a) { return mpc_many(mpcf_fold_ast, a); }
-mpc_parser_t *mpca_many1(mpc_parser_t *a) { return mpc_many1(mpcf_fold_ast, a); }
-mpc_parser_t *mpca_count(int n, mpc_parser_t *a) { return mpc_count(n, mpcf_fold_ast, a, (mpc_dtor_t)mpc_ast_delete); }
+/*
+** Packrat Memoization
+*/
 
-mpc_parser_t *mpca_or(int n, ...) {
+/*
+** When a grammar backtracks a lot the same rule
+** can be parsed again and again at the same place.
+** `mpca_memo` keeps the result of a rule for each
+** position of a string input, so the next time it
+** is asked for there the result is copied instead.
+**
+** Most rules are only ever tried once at a place,
+** so the first visit just notes the position, and
+** only the second keeps the result. The table has
+** a fixed number of slots, shared by position, and
+** a limit on the number of AST nodes it holds. Once
+** that is reached older results are thrown away, so
+** memory stays bounded however long the input is.
+** The errors a rule leaves behind are kept along
+** with its result and given back on each hit.
+*/
 
-  int i;
-  va_list va;
+enum {
+  MPC_MEMO_SLOTS     = 4096,
+  MPC_MEMO_NODES_MAX = 65536
+};
 
-  mpc_parser_t *p = mpc_undefined();
+/*
+** The counts shown by `mpc_stats` live on the parser,
+** which threads parsing with the same grammar share,
+** so they are added to atomically where possible.
+*/
+
+#if defined(__GNUC__) || defined(__clang__)
+#define mpc_memo_count(x) __sync_fetch_and_add(&(x), 1)
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define mpc_memo_count(x) _InterlockedIncrement((volatile long*)&(x))
+#else
+#define mpc_memo_count(x) ((x)++)
+#endif
+
+enum {
+  MPC_MEMO_SEEN = 0,
+  MPC_MEMO_KEPT = 1,
+  MPC_MEMO_SKIP = 2
+};
+
+struct mpc_memo_t {
+  mpc_parser_t *p;
+  long pos;
+  int flags;
+  int kind;
+  int ok;
+  long nodes;
+  mpc_state_t state;
+  char last;
+  mpc_ast_t *output;
+  mpc_err_t *error;
+  mpc_err_t *caught;
+};
+
+static mpc_ast_t *mpc_ast_copy(mpc_arena_t *m, mpc_ast_t *a, long *nodes) {
   
-  p->type = MPC_TYPE_OR;
-  p->data.or.n = n;
-  p->data.or.xs = malloc(sizeof(mpc_parser_t*) * n);
+  int j;
+  mpc_ast_t *b;
   
-  va_start(va, n);  
-  for (i = 0; i < n; i++) {
-    p->data.or.xs[i] = va_arg(va, mpc_parser_t*);
+  if (a == NULL) { return NULL; }
+  
+  if (m) {
+    b = mpc_arena_node(m, mpc_arena_intern(m, a->tag), mpc_arena_str(m, a->contents), a->children_num);
+  } else {
+    b = malloc(sizeof(mpc_ast_t));
+    b->tag = malloc(strlen(a->tag) + 1);
+    strcpy(b->tag, a->tag);
+    b->contents = malloc(strlen(a->contents) + 1);
+    strcpy(b->contents, a->contents);
+    b->children_num = a->children_num;
+    b->children = a->children_num ? malloc(sizeof(mpc_ast_t*) * a->children_num) : NULL;
+    b->arena = NULL;
   }
-  va_end(va);
   
-  return p;
+  b->state = a->state;
+  for (j = 0; j < a->children_num; j++) {
+    b->children[j] = mpc_ast_copy(m, a->children[j], nodes);
+  }
   
+  (*nodes)++;
+  return b;
 }
 
-mpc_parser_t *mpca_and(int n, ...) {
+static mpc_err_t *mpc_err_copy(mpc_err_t *x) {
   
-  int i;
-  va_list va;
+  mpc_err_t *y;
   
-  mpc_parser_t *p = mpc_undefined();
+  if (x == NULL) { return NULL; }
   
-  p->type = MPC_TYPE_AND;
-  p->data.and.n = n;
-  p->data.and.f = mpcf_fold_ast;
-  p->data.and.xs = malloc(sizeof(mpc_parser_t*) * n);
-  p->data.and.dxs = malloc(sizeof(mpc_dtor_t) * (n-1));
+  y = malloc(sizeof(mpc_err_t));
+  memcpy(y, x, sizeof(mpc_err_t));
+  y->expected = x->expected_num ? malloc(sizeof(char*) * x->expected_num) : NULL;
+  if (x->expected_num) { memcpy(y->expected, x->expected, sizeof(char*) * x->expected_num); }
+  return y;
+}
+
+static void mpc_memo_evict(mpc_input_t *i, mpc_memo_t *m) {
+  if (m->kind == MPC_MEMO_KEPT) {
+    if (m->output) { mpc_ast_delete(m->output); }
+    mpc_err_delete_internal(i, m->error);
+    mpc_err_delete_internal(i, m->caught);
+    i->memo_nodes -= m->nodes;
+  }
+  memset(m, 0, sizeof(mpc_memo_t));
+}
+
+static void mpc_memo_clear(mpc_input_t *i) {
+  int j;
+  if (i->memo) {
+    for (j = 0; j < MPC_MEMO_SLOTS; j++) { mpc_memo_evict(i, &i->memo[j]); }
+    free(i->memo);
+  }
+  i->memo = NULL;
+  i->memo_nodes = 0;
+}
+
+/*
+** Look `p` up at the current position. A result kept
+** there is given back. Otherwise either the parser
+** is run as normal, or on the second visit is run
+** with what it gives handed to `mpc_memo_keep`.
+*/
+
+static int mpc_memo_find(mpc_input_t *i, mpc_parser_t *p, mpc_frame_t *f, mpc_result_t *r, mpc_err_t **e) {
   
-  va_start(va, n);
-  for (i = 0; i < n; i++) {
-    p->data.and.xs[i] = va_arg(va, mpc_parser_t*);
+  mpc_memo_t *m;
+  long pos = i->state.pos;
+  long nodes = 0;
+  int flags = (i->suppress > 0) | ((i->backtrack < 1) << 1);
+  
+  if (i->type != MPC_INPUT_STRING) { return MPC_PARSE_DEFER; }
+  
+  if (i->memo == NULL) { i->memo = calloc(MPC_MEMO_SLOTS, sizeof(mpc_memo_t)); }
+  
+  m = &i->memo[((unsigned long)pos * 31 + ((unsigned long)(size_t)p >> 4)) % MPC_MEMO_SLOTS];
+  mpc_memo_count(p->data.memo.lookups);
+  
+  if (m->p != p || m->pos != pos || m->flags != flags) {
+    mpc_memo_evict(i, m);
+    m->p = p;
+    m->pos = pos;
+    m->flags = flags;
+    m->kind = MPC_MEMO_SEEN;
+    return MPC_PARSE_DEFER;
   }
-  for (i = 0; i < (n-1); i++) {
-    p->data.and.dxs[i] = (mpc_dtor_t)mpc_ast_delete;
-  }    
-  va_end(va);
   
-  return p;  
+  if (m->kind == MPC_MEMO_SKIP) { return MPC_PARSE_DEFER; }
+  
+  if (m->kind == MPC_MEMO_KEPT) {
+    mpc_memo_count(p->data.memo.hits);
+    *e = mpc_err_merge(i, *e, mpc_err_copy(m->caught));
+    i->state = m->state;
+    i->last = m->last;
+    if (m->ok) {
+      r->output = mpc_ast_copy(i->arena, m->output, &nodes);
+    } else {
+      r->error = mpc_err_copy(m->error);
+    }
+    return m->ok;
+  }
+  
+  f->m = m;
+  f->pos = pos;
+  f->flags = flags;
+  return MPC_PARSE_KEEP;
 }
 
-mpc_parser_t *mpca_total(mpc_parser_t *a) { return mpc_total(a, (mpc_dtor_t)mpc_ast_delete); }
+/*
+** Keep the result of the second visit, with
+** `caught` the errors it left behind.
+*/
+
+static void mpc_memo_keep(mpc_input_t *i, mpc_parser_t *p, mpc_frame_t *f, int ok, mpc_result_t *r, mpc_err_t *caught) {
+  
+  mpc_memo_t *m = f->m;
+  long nodes = 0;
+  int j, k;
+  
+  mpc_memo_evict(i, m);
+  m->p = p;
+  m->pos = f->pos;
+  m->flags = f->flags;
+  m->kind = MPC_MEMO_KEPT;
+  m->ok = ok;
+  m->state = i->state;
+  m->last = i->last;
+  m->output = ok ? mpc_ast_copy(NULL, r->output, &nodes) : NULL;
+  m->error = ok ? NULL : mpc_err_copy(r->error);
+  m->caught = mpc_err_copy(caught);
+  m->nodes = nodes;
+  
+  /*
+  ** Rules finish inside out, so when full the results
+  ** further on, which this one covers, are dropped first
+  */
+  
+  if (nodes > MPC_MEMO_NODES_MAX) {
+    mpc_memo_evict(i, m);
+    m->p = p;
+    m->pos = f->pos;
+    m->flags = f->flags;
+    m->kind = MPC_MEMO_SKIP;
+  } else {
+    for (k = 0; k < 2 && i->memo_nodes + nodes > MPC_MEMO_NODES_MAX; k++) {
+      for (j = 0; j < MPC_MEMO_SLOTS; j++) {
+        if (&i->memo[j] != m && (k || i->memo[j].pos > f->pos)) { mpc_memo_evict(i, &i->memo[j]); }
+      }
+    }
+    i->memo_nodes += nodes;
+  }
+}
+
+mpc_parser_t *mpca_memo(mpc_parser_t *a) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_MEMO;
+  p->data.memo.x = a;
+  p->data.memo.lookups = 0;
+  p->data.memo.hits = 0;
+  return p;
+}
 
 /*
 ** Grammar Parser
@@ -3240,12 +5150,15 @@ static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
   mpca_stmt_t *stmt;
   mpca_stmt_t **stmts = x;
   mpc_parser_t *left;
+  int i;
 
   while(*stmts) {
     stmt = *stmts;
     left = mpca_grammar_find_parser(stmt->ident, st);
     if (st->flags & MPCA_LANG_PREDICTIVE) { stmt->grammar = mpc_predictive(stmt->grammar); }
     if (stmt->name) { stmt->grammar = mpc_expect(stmt->grammar, stmt->name); }
+    if (st->flags & MPCA_LANG_PACKRAT) { stmt->grammar = mpca_memo(stmt->grammar); }
+    if (st->flags & MPCA_LANG_ARENA)   { stmt->grammar = mpca_arena(stmt->grammar); }
     mpc_optimise(stmt->grammar);
     mpc_define(left, stmt->grammar);
     free(stmt->ident);
@@ -3254,6 +5167,12 @@ static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
     stmts++;
   }
   
+  /* Rules can refer to later ones, so look again now all are defined */
+  
+  for (i = 0; i < st->parsers_num; i++) {
+    if (st->parsers[i]) { mpc_optimise(st->parsers[i]); }
+  }
+  
   free(x);
   
   return NULL;
@@ -3440,6 +5359,9 @@ static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { return 1 + mpc_nodecount_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { return 1 + mpc_nodecount_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { return 1 + mpc_nodecount_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_DFA)      { return 1 + mpc_nodecount_unretained(p->data.dfa.x, 0); }
+  if (p->type == MPC_TYPE_MEMO)     { return 1 + mpc_nodecount_unretained(p->data.memo.x, 0); }
+  if (p->type == MPC_TYPE_ARENA)    { return 1 + mpc_nodecount_unretained(p->data.arena.x, 0); }
 
   if (p->type == MPC_TYPE_NOT)   { return 1 + mpc_nodecount_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MAYBE) { return 1 + mpc_nodecount_unretained(p->data.not.x, 0); }
@@ -3468,10 +5390,69 @@ static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
   
 }
 
+typedef struct {
+  int ors;
+  int dispatched;
+  int ll1;
+  int memos;
+  unsigned long lookups;
+  unsigned long hits;
+} mpc_stats_t;
+
+static void mpc_stats_unretained(mpc_parser_t* p, int force, mpc_stats_t *s) {
+
+  int i;
+
+  if (p->retained && !force) { return; }
+
+  if (p->type == MPC_TYPE_EXPECT)   { mpc_stats_unretained(p->data.expect.x, 0, s); }
+  if (p->type == MPC_TYPE_APPLY)    { mpc_stats_unretained(p->data.apply.x, 0, s); }
+  if (p->type == MPC_TYPE_APPLY_TO) { mpc_stats_unretained(p->data.apply_to.x, 0, s); }
+  if (p->type == MPC_TYPE_PREDICT)  { mpc_stats_unretained(p->data.predict.x, 0, s); }
+  if (p->type == MPC_TYPE_DFA)      { mpc_stats_unretained(p->data.dfa.x, 0, s); }
+  if (p->type == MPC_TYPE_NOT)      { mpc_stats_unretained(p->data.not.x, 0, s); }
+  if (p->type == MPC_TYPE_MAYBE)    { mpc_stats_unretained(p->data.not.x, 0, s); }
+  if (p->type == MPC_TYPE_MANY)     { mpc_stats_unretained(p->data.repeat.x, 0, s); }
+  if (p->type == MPC_TYPE_MANY1)    { mpc_stats_unretained(p->data.repeat.x, 0, s); }
+  if (p->type == MPC_TYPE_COUNT)    { mpc_stats_unretained(p->data.repeat.x, 0, s); }
+  if (p->type == MPC_TYPE_ARENA)    { mpc_stats_unretained(p->data.arena.x, 0, s); }
+
+  if (p->type == MPC_TYPE_MEMO) {
+    s->memos++;
+    s->lookups += p->data.memo.lookups;
+    s->hits += p->data.memo.hits;
+    mpc_stats_unretained(p->data.memo.x, 0, s);
+  }
+
+  if (p->type == MPC_TYPE_OR) {
+    s->ors++;
+    if (p->data.or.d) { s->dispatched++; s->ll1 += p->data.or.d->ll1; }
+    for(i = 0; i < p->data.or.n; i++) {
+      mpc_stats_unretained(p->data.or.xs[i], 0, s);
+    }
+  }
+  
+  if (p->type == MPC_TYPE_AND) {
+    for(i = 0; i < p->data.and.n; i++) {
+      mpc_stats_unretained(p->data.and.xs[i], 0, s);
+    }
+  }
+  
+}
+
 void mpc_stats(mpc_parser_t* p) {
+  mpc_stats_t s;
+  memset(&s, 0, sizeof(mpc_stats_t));
+  mpc_stats_unretained(p, 1, &s);
   printf("Stats\n");
   printf("=====\n");
   printf("Node Count: %i\n", mpc_nodecount_unretained(p, 1));
+  printf("Or Count: %i\n", s.ors);
+  printf("Dispatch Count: %i (LL(1): %i)\n", s.dispatched, s.ll1);
+  if (s.memos) {
+    printf("Memo Lookups: %lu\n", s.lookups);
+    printf("Memo Hits: %lu\n", s.hits);
+  }
 }
 
 static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
@@ -3487,6 +5468,8 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { mpc_optimise_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { mpc_optimise_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { mpc_optimise_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_MEMO)     { mpc_optimise_unretained(p->data.memo.x, 0); }
+  if (p->type == MPC_TYPE_ARENA)    { mpc_optimise_unretained(p->data.arena.x, 0); }
   if (p->type == MPC_TYPE_NOT)      { mpc_optimise_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MAYBE)    { mpc_optimise_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MANY)     { mpc_optimise_unretained(p->data.repeat.x, 0); }
@@ -3518,6 +5501,7 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       p->data.or.n = n + m - 1;
       p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
       memmove(p->data.or.xs + n - 1, t->data.or.xs, m * sizeof(mpc_parser_t*));
+      mpc_dispatch_delete(t->data.or.d);
       free(t->data.or.xs); free(t->name); free(t);
       continue;
     }
@@ -3530,8 +5514,9 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       n = p->data.or.n; m = t->data.or.n;
       p->data.or.n = n + m - 1;
       p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
-      memmove(p->data.or.xs + m, t->data.or.xs + 1, n * sizeof(mpc_parser_t*));
+      memmove(p->data.or.xs + m, p->data.or.xs + 1, (n - 1) * sizeof(mpc_parser_t*));
       memmove(p->data.or.xs, t->data.or.xs, m * sizeof(mpc_parser_t*));
+      mpc_dispatch_delete(t->data.or.d);
       free(t->data.or.xs); free(t->name); free(t);
       continue;
     }
@@ -3635,6 +5620,12 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       continue;
     }
     
+    /* Dispatch `or` on the next character */
+    if (p->type == MPC_TYPE_OR) {
+      mpc_dispatch_delete(p->data.or.d);
+      p->data.or.d = mpc_dispatch_new(p);
+    }
+    
     return;
     
   }
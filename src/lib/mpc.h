@@ -64,6 +64,19 @@ int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_res
 int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r);
+int mpc_nparse(const char *filename, const char *string, long length, mpc_parser_t *p, mpc_result_t *r);
+
+/*
+** Reusable Inputs
+*/
+
+struct mpc_input_t;
+typedef struct mpc_input_t mpc_input_t;
+
+mpc_input_t *mpc_input_new_nstring(const char *filename, const char *string, long length);
+void mpc_input_reset_nstring(mpc_input_t *i, const char *filename, const char *string, long length);
+void mpc_input_delete(mpc_input_t *i);
+int mpc_parse_input(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r);
 
 /*
 ** Function Types
@@ -262,6 +275,7 @@ typedef struct mpc_ast_t {
   mpc_state_t state;
   int children_num;
   struct mpc_ast_t** children;
+  struct mpc_arena_t *arena;
 } mpc_ast_t;
 
 mpc_ast_t *mpc_ast_new(const char *tag, const char *contents);
@@ -305,11 +319,15 @@ mpc_parser_t *mpca_count(int n, mpc_parser_t *a);
 
 mpc_parser_t *mpca_or(int n, ...);
 mpc_parser_t *mpca_and(int n, ...);
+mpc_parser_t *mpca_memo(mpc_parser_t *a);
+mpc_parser_t *mpca_arena(mpc_parser_t *a);
 
 enum {
   MPCA_LANG_DEFAULT              = 0,
   MPCA_LANG_PREDICTIVE           = 1,
-  MPCA_LANG_WHITESPACE_SENSITIVE = 2
+  MPCA_LANG_WHITESPACE_SENSITIVE = 2,
+  MPCA_LANG_PACKRAT              = 4,
+  MPCA_LANG_ARENA                = 8
 };
 
 mpc_parser_t *mpca_grammar(int flags, const char *grammar, ...);
@@ -0,0 +1,42 @@
+#!/bin/sh
+# loads each file in tests/readers through the direct reader and through the
+# mpc grammar it replaces, and checks that both give the same output. the two
+# word syntax errors differently, so errors only have to agree on where they
+# are and what was found there, and blank lines are dropped since mpc ends
+# its errors with a newline. files with an error hold a single form, since
+# the direct reader evaluates the forms before it as it goes
+#
+#   sh tests/check_readers.sh bin/slither bin/slither-mpc
+
+direct=$1
+mpc=$2
+dir=$(dirname "$0")/readers
+tmp=${TMPDIR:-/tmp}/slither-readers.$$
+mkdir -p "$tmp"
+
+# nesting far deeper than a recursive reader could manage on the C stack
+awk 'BEGIN { for (i = 0; i < 100000; i++) printf "{"; print "" }' > "$tmp/deep-open.slr"
+awk 'BEGIN { printf "(print (len "; for (i = 0; i < 2000; i++) printf "{";
+             for (i = 0; i < 2000; i++) printf "}"; print "))" }' > "$tmp/deep.slr"
+
+run() {
+    "$1" "$2" > "$tmp/out" 2>&1
+    echo "exit $?" >> "$tmp/out"
+    sed -e 's/: error: expected .* at /: error: at /' -e '/^$/d' "$tmp/out"
+}
+
+status=0
+for f in "$dir"/*.slr "$tmp"/deep-open.slr "$tmp"/deep.slr; do
+    run "$direct" "$f" > "$tmp/direct.out"
+    run "$mpc" "$f" > "$tmp/mpc.out"
+    if cmp -s "$tmp/direct.out" "$tmp/mpc.out"; then
+        echo "ok   $(basename "$f")"
+    else
+        echo "FAIL $(basename "$f")"
+        diff "$tmp/mpc.out" "$tmp/direct.out"
+        status=1
+    fi
+done
+
+rm -rf "$tmp"
+exit $status
@@ -0,0 +1,166 @@
+// runs the slither grammar and a backtracking arithmetic grammar over a set
+// of inputs under each mpca_lang mode, then every regex below over every
+// string below, and prints each ast, match or error. the output is checked
+// against mpc_check.expected, written by the mpc this tree started from, so
+// the regex DFA, predictive dispatch, packrat memos, arenas and lazy errors
+// all have to give the same asts, matches and error messages it did
+//
+//   cc -std=c99 -Isrc/lib tests/mpc_check.c src/lib/mpc.c -lm -o bin/mpc_check
+//   bin/mpc_check | diff tests/mpc_check.expected -
+
+#include "mpc.h"
+
+typedef struct {
+    char* name;
+    int flags;
+} mode;
+
+mode modes[] = {
+    { "DEFAULT", MPCA_LANG_DEFAULT },
+    { "PREDICTIVE", MPCA_LANG_PREDICTIVE },
+    { "PACKRAT", MPCA_LANG_PACKRAT },
+    { "ARENA", MPCA_LANG_ARENA },
+    { "PACKRAT|ARENA", MPCA_LANG_PACKRAT | MPCA_LANG_ARENA },
+};
+
+char* slither_inputs[] = {
+    "", "(+ 1 2)", "(def {x} 10) ; hi\n(print \"a\\\"b\" 1.5 -3 -x 12abc)",
+    "(+ 1 2", "{1 2", "(1 . 2)", "\"abc", "1.", ")", "#",
+    "(a \"x\\qy\" 12abc -5 - -a 1.2.3)", "((((((((((1))))))))))",
+    "; only comment", "(a\n b\n  (c \"d\ne\") ]", "12.34.56", "-", "--1", "1-2",
+    "\"\\\\\"", "{}()", "(\"unterminated\\\"",
+};
+
+char* maths_inputs[] = {
+    "1+2*3", "((1+2)*(3-4))/5", "1+", "(1", "1+2)", "((((((1))))))*2", "",
+    "a", "1 + 2",
+};
+
+char* patterns[] = {
+    "ab", "a*b", "a+", "[a-c]+d?", "(ab|ac)", "(a|ab)c", "^abc$", "a{2}",
+    "a{2,4}", "\\d+\\.\\d+", "[^x]*x", ".*", "(foo|bar)+baz", "a|b|c", "x?y",
+    "[", "(a", "\\w+@\\w+\\.com", "$", "^", "[0-9]+$",
+};
+
+char* strings[] = {
+    "", "ab", "aab", "abc", "ac", "aaaa", "3.14", "bcd", "xxx", "foobarbaz",
+    "abcd", "a@b.com", "b", "y", "12a", "12",
+};
+
+#define COUNT(xs) ((int) (sizeof(xs) / sizeof(xs[0])))
+
+void print_result(int ok, mpc_result_t* r) {
+    if (ok) {
+        mpc_ast_print(r->output);
+        mpc_ast_delete(r->output);
+    } else {
+        char* err = mpc_err_string(r->error);
+        printf("error: %s", err);
+        free(err);
+        mpc_err_delete(r->error);
+    }
+}
+
+int check_slither(int flags) {
+    mpc_parser_t* Float = mpc_new("float");
+    mpc_parser_t* Int = mpc_new("int");
+    mpc_parser_t* Symbol = mpc_new("symbol");
+    mpc_parser_t* String = mpc_new("string");
+    mpc_parser_t* Comment = mpc_new("comment");
+    mpc_parser_t* Sexpr = mpc_new("sexpr");
+    mpc_parser_t* Qexpr = mpc_new("qexpr");
+    mpc_parser_t* Expr = mpc_new("expr");
+    mpc_parser_t* Slither = mpc_new("slither");
+
+    mpc_err_t* e = mpca_lang(flags,
+        "float   : /-?[0-9]+\\.?[0-9]+/ ;                       \
+         int     : /-?[0-9]+/ ;                                 \
+         symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&|%^]+/ ;        \
+         string  : /\"(\\\\.|[^\"])*\"/ ;                       \
+         comment : /;[^\\r\\n]*/ ;                              \
+         sexpr   : '(' <expr>* ')' ;                            \
+         qexpr   : '{' <expr>* '}' ;                            \
+         expr    : <float> | <int> | <symbol> | <sexpr>         \
+                 | <qexpr> | <string> | <comment> ;             \
+         slither : /^/ <expr>* /$/ ;",
+        Float, Int, Symbol, String, Comment, Sexpr, Qexpr, Expr, Slither);
+    if (e) {
+        mpc_err_print(e);
+        mpc_err_delete(e);
+        return 1;
+    }
+
+    for (int i = 0; i < COUNT(slither_inputs); i++) {
+        mpc_result_t r;
+        printf("== %s\n", slither_inputs[i]);
+        print_result(mpc_parse("<t>", slither_inputs[i], Slither, &r), &r);
+    }
+
+    mpc_cleanup(9, Float, Int, Symbol, String, Comment, Sexpr, Qexpr, Expr, Slither);
+    return 0;
+}
+
+// t and e try each alternative in turn, so all but the last have to be
+// backed out of once they have read a number
+int check_maths(int flags) {
+    mpc_parser_t* N = mpc_new("n");
+    mpc_parser_t* F = mpc_new("f");
+    mpc_parser_t* T = mpc_new("t");
+    mpc_parser_t* E = mpc_new("e");
+    mpc_parser_t* M = mpc_new("m");
+
+    mpc_err_t* e = mpca_lang(flags,
+        "n : /[0-9]+/ ;                                  \
+         f : '(' <e> ')' | <n> ;                         \
+         t : <f> '*' <t> | <f> '/' <t> | <f> ;           \
+         e : <t> '+' <e> | <t> '-' <e> | <t> ;           \
+         m : /^/ <e> /$/ ;",
+        N, F, T, E, M);
+    if (e) {
+        mpc_err_print(e);
+        mpc_err_delete(e);
+        return 1;
+    }
+
+    for (int i = 0; i < COUNT(maths_inputs); i++) {
+        mpc_result_t r;
+        printf("== %s\n", maths_inputs[i]);
+        print_result(mpc_parse("<t>", maths_inputs[i], M, &r), &r);
+    }
+
+    mpc_cleanup(5, N, F, T, E, M);
+    return 0;
+}
+
+// regexes take no mode, so these only run once
+void check_regexes(void) {
+    for (int i = 0; i < COUNT(patterns); i++) {
+        for (int j = 0; j < COUNT(strings); j++) {
+            mpc_parser_t* re = mpc_re(patterns[i]);
+            mpc_result_t r;
+            printf("[%s] on [%s]: ", patterns[i], strings[j]);
+            if (mpc_parse("<re>", strings[j], re, &r)) {
+                printf("'%s'\n", (char*) r.output);
+                free(r.output);
+            } else {
+                char* err = mpc_err_string(r.error);
+                printf("error: %s", err);
+                free(err);
+                mpc_err_delete(r.error);
+            }
+            mpc_delete(re);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    for (int i = 0; i < COUNT(modes); i++) {
+        printf("# slither grammar, %s\n", modes[i].name);
+        if (check_slither(modes[i].flags)) { return 1; }
+        printf("# maths grammar, %s\n", modes[i].name);
+        if (check_maths(modes[i].flags)) { return 1; }
+    }
+    printf("# regexes\n");
+    check_regexes();
+    return 0;
+}